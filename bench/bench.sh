@@ -0,0 +1,30 @@
+#!/bin/sh
+# Measure typescript2txt on generated typescripts of each kind of
+# terminal session.  This is what "make bench" runs.
+#
+# USAGE: bench/bench.sh [size_in_MB] [runs] [binary]
+#
+# Each workload made by bench/gen_typescript is generated once (the
+# same bytes every time) and kept in bench/data.  The binary (by
+# default ./typescript2txt) is run on each the given number of times
+# and the best time is reported with the throughput in MB/s and in
+# output lines per second, and the peak resident set size.  Running
+# the script with a binary built from an older revision shows whether
+# a change made things slower.
+set -e
+cd "$(dirname "$0")/.."
+size_mb=${1:-20}
+runs=${2:-5}
+bin=${3:-./typescript2txt}
+
+mkdir -p bench/data
+for workload in plain ls progress readline vim less osc mixed; do
+    input=bench/data/gen_${workload}_${size_mb}MB.txt
+    if [ ! -f "$input" ]; then
+	bench/gen_typescript "$workload" "$size_mb" > "$input"
+    fi
+    lines=$("$bin" --quiet "$input" | wc -l)
+    bench/runstat -r "$runs" -l "$workload" -b "$(wc -c < "$input")" \
+	-n "$lines" -- \
+	"$bin" --quiet "$input"
+done
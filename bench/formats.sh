@@ -0,0 +1,33 @@
+#!/bin/sh
+# Compare the time and memory typescript2txt needs to keep colours and
+# other attributes (--format=ansi and --format=html) with plain text.
+#
+# USAGE: bench/formats.sh [size_in_MB] [runs] [binary]
+#
+# The inputs are the colour heavy workloads of bench/gen_typescript
+# (colored ls output and the mix of all sessions) and, for comparison,
+# plain command output with no attributes at all.  Each is converted
+# whole (all lines held until the end, so the peak resident set size
+# shows the memory used for the attributes) and with --stream.
+set -e
+cd "$(dirname "$0")/.."
+size_mb=${1:-20}
+runs=${2:-5}
+bin=${3:-./typescript2txt}
+make -s bench/runstat bench/gen_typescript
+
+mkdir -p bench/data
+for workload in ls mixed plain; do
+    input=bench/data/gen_${workload}_${size_mb}MB.txt
+    if [ ! -f "$input" ]; then
+	bench/gen_typescript "$workload" "$size_mb" > "$input"
+    fi
+    echo "== $input"
+    for format in text ansi html; do
+	for stream in "" --stream; do
+	    bench/runstat -r "$runs" -l "$format $stream" \
+		-b "$(wc -c < "$input")" -- \
+		"$bin" --quiet --format=$format $stream "$input"
+	done
+    done
+done
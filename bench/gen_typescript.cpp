@@ -0,0 +1,342 @@
+/********************************************************************
+ * gen_typescript - write a synthetic typescript for benchmarking
+ *
+ * USAGE: gen_typescript workload size_in_MB [seed] > typescript
+ *
+ * Workloads:
+ *   plain     prompts and plain command output
+ *   ls        colored ls output
+ *   progress  progress bars redrawn with carriage returns
+ *   readline  command line editing: backspaces, inserts, deletes
+ *   vim       full screen editing: cursor addressing, scrolling
+ *   less      paging with reverse scrolling and standout prompts
+ *   osc       window title changes around short commands
+ *   mixed     all of the above, in blocks
+ *
+ * The output depends only on the arguments (the random numbers come
+ * from a generator defined here, not from the C library), so the same
+ * command always writes the same bytes on any machine.
+ *
+ * Permission is granted to distribute this software under any version
+ * of the BSD and GPL licenses.
+ *******************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <stdint.h>
+
+/// A small, fast pseudo-random number generator (xorshift64*) whose
+/// sequence is the same everywhere
+class Random{
+  /// The state of the generator, never 0
+  uint64_t state;
+public:
+  /// Create a generator whose sequence is determined by \a seed
+  explicit Random(uint64_t seed):state(seed * 2654435761u + 88172645463325252ull){}
+
+  /// Return the next number in the sequence
+  uint64_t next(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+  }
+
+  /// Return a number in [0, n)
+  unsigned below(unsigned n){
+    return (unsigned)((next() >> 33) % n);
+  }
+
+  /// Return a number in [lo, hi]
+  unsigned between(unsigned lo, unsigned hi){
+    return lo + below(hi - lo + 1);
+  }
+};
+
+/// Words used to make up file names and output
+static const char* const words[] = {
+  "build", "src", "main", "test", "config", "lib", "include", "data",
+  "report", "index", "util", "parser", "reader", "writer", "cache",
+  "server", "client", "README", "Makefile", "notes", "draft", "log",
+  "error", "warning", "compiling", "linking", "done", "the", "of",
+  "and", "to", "with", "for", "file", "line", "value", "result"
+};
+
+/// The number of entries in words
+static const unsigned num_words = sizeof(words)/sizeof(words[0]);
+
+/// Writes one workload of synthetic typescript
+class Generator{
+  /// The random numbers deciding what is written
+  Random rnd;
+  /// The text generated but not yet written
+  std::string out;
+  /// The number of bytes written so far
+  uint64_t written;
+
+  /// Append \a s to the output
+  void put(const std::string& s){ out += s; }
+
+  /// Append the decimal value of \a n to the output
+  void put_num(unsigned n){
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%u", n);
+    out += buf;
+  }
+
+  /// Append a random word
+  void put_word(){ out += words[rnd.below(num_words)]; }
+
+  /// Append \a n random words separated by spaces
+  void put_words(unsigned n){
+    for(unsigned i = 0; i < n; ++i){
+      if(i > 0){ out += ' '; }
+      put_word();
+    }
+  }
+
+  /// Append a shell prompt
+  void prompt(){
+    put("user@host:~/");
+    put_word();
+    put("$ ");
+  }
+
+  /// Append a command typed at a prompt, ending with its newline
+  void command(){
+    prompt();
+    put_words(rnd.between(1, 4));
+    put("\r\n");
+  }
+
+  /// Write the output collected so far
+  void flush(){
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    written += out.size();
+    out.clear();
+  }
+
+  /// Prompts followed by lines of plain output
+  void plain(){
+    command();
+    unsigned n = rnd.between(1, 40);
+    for(unsigned i = 0; i < n; ++i){
+      put_words(rnd.between(2, 16));
+      put("\r\n");
+    }
+  }
+
+  /// ls --color output: colored names in columns
+  void ls(){
+    static const char* const colors[] = {
+      "01;34", "01;32", "01;36", "00", "01;31", "01;35"
+    };
+    prompt();
+    put("ls --color\r\n");
+    unsigned rows = rnd.between(1, 12);
+    for(unsigned r = 0; r < rows; ++r){
+      for(unsigned c = 0; c < 4; ++c){
+	put("\x1b[0m\x1b[");
+	put(colors[rnd.below(6)]);
+	put("m");
+	put_word();
+	put("\x1b[0m  ");
+      }
+      put("\r\n");
+    }
+  }
+
+  /// Progress bars redrawn in place with carriage returns
+  void progress(){
+    command();
+    for(unsigned pct = 0; pct <= 100; pct += rnd.between(1, 3)){
+      put("\r");
+      if(pct < 10){ put("  "); }else if(pct < 100){ put(" "); }
+      put_num(pct);
+      put("% [");
+      put(std::string(pct * 40 / 100, '='));
+      put(">");
+      put(std::string(40 - pct * 40 / 100, ' '));
+      put("] ");
+      put_num(rnd.between(100, 9999));
+      put(" KB/s");
+      if(rnd.below(4) == 0){ put("\x1b[K"); }
+    }
+    put("\r\n");
+  }
+
+  /// Command line editing as bash's readline does it
+  void readline(){
+    prompt();
+    put_words(rnd.between(2, 6));
+    unsigned edits = rnd.between(1, 10);
+    for(unsigned e = 0; e < edits; ++e){
+      switch(rnd.below(6)){
+      case 0: //Erase the last few characters
+	for(unsigned i = rnd.between(1, 5); i > 0; --i){ put("\b \b"); }
+	break;
+      case 1: //Move left and insert
+	put("\b\b\b\x1b[1@");
+	put("x");
+	break;
+      case 2: //Move left and delete
+	put("\x1b[4D\x1b[2P");
+	break;
+      case 3: //Move right
+	put("\x1b[2C");
+	break;
+      case 4: //Recall history: redraw the whole line
+	put("\r\x1b[K");
+	prompt();
+	put_words(rnd.between(1, 5));
+	break;
+      default: //Type more
+	put(" ");
+	put_word();
+      }
+    }
+    put("\r\n");
+  }
+
+  /// A vim session: full screen redraws, cursor addressing, scrolling
+  void vim(){
+    command();
+    put("\x1b[?1049h\x1b[22;0;0t\x1b[?1h\x1b=\x1b[H\x1b[2J");
+    for(unsigned row = 1; row <= 23; ++row){
+      put("\x1b[");
+      put_num(row);
+      put(";1H");
+      put_words(rnd.between(0, 10));
+      put("\x1b[K");
+    }
+    put("\x1b[24;1H\x1b[7m\"");
+    put_word();
+    put(".txt\" 23L, 1024C\x1b[27m");
+    unsigned moves = rnd.between(5, 40);
+    for(unsigned m = 0; m < moves; ++m){
+      switch(rnd.below(4)){
+      case 0: //Scroll one line
+	put("\x1b[1;23r\x1b[23;1H\n");
+	put_words(rnd.between(0, 10));
+	put("\x1b[1;24r");
+	break;
+      case 1: //Type on a line
+	put("\x1b[");
+	put_num(rnd.between(1, 23));
+	put(";");
+	put_num(rnd.between(1, 60));
+	put("H\x1b[1@");
+	put_word();
+	break;
+      case 2: //Update the ruler
+	put("\x1b[24;63H");
+	put_num(rnd.between(1, 500));
+	put(",");
+	put_num(rnd.between(1, 80));
+	put("\x1b[10CAll");
+	break;
+      default: //Move the cursor
+	put("\x1b[?25l\x1b[");
+	put_num(rnd.between(1, 23));
+	put(";");
+	put_num(rnd.between(1, 80));
+	put("H\x1b[?25h");
+      }
+    }
+    put("\x1b[24;1H\x1b[K\x1b[?1l\x1b>\x1b[?1049l");
+  }
+
+  /// A less session: pages of text, backward scrolling, standout prompt
+  void less(){
+    command();
+    unsigned pages = rnd.between(1, 5);
+    for(unsigned p = 0; p < pages; ++p){
+      for(unsigned i = 0; i < 23; ++i){
+	put_words(rnd.between(1, 12));
+	put("\r\n");
+      }
+      put("\x1b[7m:\x1b[27m\x1b[K");
+      if(rnd.below(3) == 0){
+	for(unsigned b = rnd.between(1, 5); b > 0; --b){
+	  put("\r\x1b[K\x1b[H\x1bM");
+	  put_words(rnd.between(1, 12));
+	  put("\x1b[24;1H\r\x1b[K:");
+	}
+      }
+      put("\r\x1b[K");
+    }
+  }
+
+  /// Window title changes around every prompt
+  void osc(){
+    put("\x1b]0;user@host: ~/");
+    put_word();
+    put("\x07");
+    command();
+    unsigned n = rnd.between(0, 3);
+    for(unsigned i = 0; i < n; ++i){
+      put_words(rnd.between(1, 8));
+      put("\r\n");
+    }
+  }
+public:
+  /// Create a generator using \a seed for its random numbers
+  explicit Generator(uint64_t seed):rnd(seed),written(0){}
+
+  /// \brief Write at least \a bytes of the named \a workload to
+  /// \brief standard output.  Return false if there is no such workload.
+  bool run(const std::string& workload, uint64_t bytes){
+    typedef void (Generator::*Part)();
+    static const struct{ const char* name; Part part; } parts[] = {
+      {"plain", &Generator::plain}, {"ls", &Generator::ls},
+      {"progress", &Generator::progress},
+      {"readline", &Generator::readline},
+      {"vim", &Generator::vim}, {"less", &Generator::less},
+      {"osc", &Generator::osc}
+    };
+    const unsigned num_parts = sizeof(parts)/sizeof(parts[0]);
+    Part part = NULL;
+    for(unsigned i = 0; i < num_parts; ++i){
+      if(workload == parts[i].name){ part = parts[i].part; }
+    }
+    if(part == NULL && workload != "mixed"){
+      return false;
+    }
+    while(written < bytes){
+      if(part != NULL){
+	(this->*part)();
+      }else{
+	//A block of one kind of session at a time
+	Part p = parts[rnd.below(num_parts)].part;
+	for(unsigned i = rnd.between(1, 20); i > 0; --i){
+	  (this->*p)();
+	}
+      }
+      if(out.size() >= 64*1024){
+	flush();
+      }
+    }
+    flush();
+    return true;
+  }
+};
+
+int main(int argc, char** argv){
+  if(argc < 3 || argc > 4){
+    std::cerr << "Usage: gen_typescript workload size_in_MB [seed]\n"
+	      << "workload is one of plain, ls, progress, readline, vim, "
+	      << "less, osc or mixed\n";
+    return 2;
+  }
+  double mb = std::atof(argv[2]);
+  uint64_t seed = (argc == 4) ? std::strtoull(argv[3], NULL, 10) : 1;
+  Generator gen(seed);
+  if(mb <= 0 || !gen.run(argv[1], (uint64_t)(mb * 1e6))){
+    std::cerr << "gen_typescript: unknown workload \"" << argv[1]
+	      << "\" or bad size \"" << argv[2] << "\"\n";
+    return 2;
+  }
+  return 0;
+}
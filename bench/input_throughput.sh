@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compare the ways typescript2txt can be given its input on a large
+# typescript made by concatenating the test inputs.
+#
+# USAGE: bench/input_throughput.sh [size_in_MB] [baseline_binary]
+#
+# If a baseline binary (e.g. one built from an older revision) is
+# given, it is timed reading the same file from standard input.
+set -e
+cd "$(dirname "$0")/.."
+size_mb=${1:-50}
+baseline=$2
+
+mkdir -p bench/data
+input=bench/data/concat_tests_${size_mb}MB.txt
+if [ ! -f "$input" ]; then
+    cat tests/*_input.txt > bench/data/concat_tests_unit.txt
+    unit=$(wc -c < bench/data/concat_tests_unit.txt)
+    reps=$(( size_mb * 1000000 / unit + 1 ))
+    : > "$input"
+    i=0
+    while [ $i -lt $reps ]; do
+	cat bench/data/concat_tests_unit.txt
+	i=$((i + 1))
+    done >> "$input"
+    rm -f bench/data/concat_tests_unit.txt
+fi
+
+bytes=$(wc -c < "$input")
+bench/runstat -l "file argument (mmap)" -b "$bytes" -- ./typescript2txt "$input"
+bench/runstat -l "stdin redirect (mmap)" -i "$input" -- ./typescript2txt
+bench/runstat -l "stdin pipe (read)" -b "$bytes" -- \
+    sh -c "cat '$input' | ./typescript2txt"
+if [ -n "$baseline" ]; then
+    bench/runstat -l "baseline, stdin" -i "$input" -- "$baseline"
+fi
@@ -0,0 +1,61 @@
+/********************************************************************
+ * malloc_count - count the heap allocations made by a program
+ *
+ * USAGE: LD_PRELOAD=bench/malloc_count.so command...
+ *
+ * Replaces malloc, calloc and realloc with versions that count their
+ * calls before passing them on to the C library.  When the program
+ * exits, the count is printed on standard error as
+ *
+ *     malloc_count: N allocations
+ *
+ * Only works with glibc, which exports the __libc_ versions of the
+ * allocation functions.
+ *
+ * Permission is granted to distribute this software under any version
+ * of the BSD and GPL licenses.
+ *******************************************************************/
+
+#include <cstddef>
+#include <cstdio>
+#include <unistd.h>
+
+extern "C" {
+  void* __libc_malloc(std::size_t size);
+  void* __libc_calloc(std::size_t n, std::size_t size);
+  void* __libc_realloc(void* p, std::size_t size);
+}
+
+/// The number of allocation calls so far
+static unsigned long allocations = 0;
+
+/// Count one allocation (safe to call from several threads)
+static inline void count(){
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+extern "C" void* malloc(std::size_t size){
+  count();
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t n, std::size_t size){
+  count();
+  return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, std::size_t size){
+  count();
+  return __libc_realloc(p, size);
+}
+
+/// Print the count when the program exits
+__attribute__((destructor))
+static void report(){
+  char msg[64];
+  int len = std::snprintf(msg, sizeof(msg), "malloc_count: %lu allocations\n",
+			  allocations);
+  if(write(2, msg, len) < 0){
+    //Nothing useful can be done about a failed report
+  }
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Report heap allocation counts and peak memory use of typescript2txt
+# on large generated typescripts.
+#
+# USAGE: bench/memory.sh [size_in_MB] [baseline_binary]
+#
+# The inputs are a concatenation of the test inputs and a typescript
+# of many short lines, both about size_in_MB.  They are piped in so
+# that the peak resident set size does not include a mapped input
+# file.  If a baseline binary is given, it is measured as well.
+set -e
+cd "$(dirname "$0")/.."
+size_mb=${1:-50}
+baseline=$2
+make -s bench/runstat bench/malloc_count.so
+
+mkdir -p bench/data
+concat=bench/data/concat_tests_${size_mb}MB.txt
+if [ ! -f "$concat" ]; then
+    cat tests/*_input.txt > bench/data/concat_tests_unit.txt
+    unit=$(wc -c < bench/data/concat_tests_unit.txt)
+    reps=$(( size_mb * 1000000 / unit + 1 ))
+    i=0
+    while [ $i -lt $reps ]; do
+	cat bench/data/concat_tests_unit.txt
+	i=$((i + 1))
+    done > "$concat"
+    rm -f bench/data/concat_tests_unit.txt
+fi
+short=bench/data/short_lines_${size_mb}MB.txt
+if [ ! -f "$short" ]; then
+    awk -v n=$((size_mb * 1000000 / 25)) \
+	'BEGIN{ for(i = 0; i < n; ++i) printf "line %d of the output\r\n", i }' \
+	> "$short"
+fi
+
+measure(){ # label binary input [options]
+    label=$1; bin=$2; input=$3; shift 3
+    bench/runstat -r 1 -l "$label" -b "$(wc -c < "$input")" -- \
+	sh -c "cat '$input' | '$bin' $*" 2>/dev/null
+    LD_PRELOAD=$PWD/bench/malloc_count.so "$bin" "$@" < "$input" \
+	2>&1 >/dev/null | sed -n 's/^malloc_count: /    /p'
+}
+
+for input in "$concat" "$short"; do
+    echo "== $input"
+    measure "typescript2txt" ./typescript2txt "$input"
+    measure "typescript2txt --stream" ./typescript2txt "$input" --stream
+    if [ -n "$baseline" ]; then
+	measure "baseline" "$baseline" "$input"
+    fi
+done
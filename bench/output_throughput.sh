@@ -0,0 +1,27 @@
+#!/bin/sh
+# Measure how fast typescript2txt writes its output, and with how many
+# write system calls, on a typescript made of many short lines.
+#
+# USAGE: bench/output_throughput.sh [millions_of_lines] [baseline_binary]
+#
+# If a baseline binary (e.g. one built from an older revision) is
+# given, it is measured on the same input.
+set -e
+cd "$(dirname "$0")/.."
+millions=${1:-2}
+baseline=$2
+
+mkdir -p bench/data
+input=bench/data/short_lines_${millions}M.txt
+if [ ! -f "$input" ]; then
+    awk -v n=$((millions * 1000000)) \
+	'BEGIN{ for(i = 0; i < n; ++i) printf "line %d of the output\r\n", i }' \
+	> "$input"
+fi
+
+bench/runstat -l "typescript2txt" -i "$input" -- ./typescript2txt
+bench/runstat -l "typescript2txt --stream" -i "$input" -- \
+    ./typescript2txt --stream
+if [ -n "$baseline" ]; then
+    bench/runstat -l "baseline" -i "$input" -- "$baseline"
+fi
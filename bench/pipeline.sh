@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare the wall-clock time of the serial conversion with --pipeline
+# (reading, parsing and writing on three threads).
+#
+# USAGE: bench/pipeline.sh [size_in_MB] [runs] [binary]
+#
+# Each of a plain and a mixed typescript is converted whole and with
+# --stream (where lines go to the writer thread while parsing goes
+# on), once with the text written to a file on disk and once to
+# /dev/null.  The input is read through a pipe as well as from the
+# file, since a pipe cannot be mapped into memory.  On a machine with
+# one processor the threads take turns, so expect no gain there.
+set -e
+cd "$(dirname "$0")/.."
+size_mb=${1:-100}
+runs=${2:-3}
+bin=${3:-./typescript2txt}
+make -s bench/runstat bench/gen_typescript
+
+mkdir -p bench/data
+out=bench/data/pipeline_output.txt
+for workload in plain mixed; do
+    input=bench/data/gen_${workload}_${size_mb}MB.txt
+    if [ ! -f "$input" ]; then
+	bench/gen_typescript "$workload" "$size_mb" > "$input"
+    fi
+    bytes=$(wc -c < "$input")
+    echo "== $input"
+    for stream in "" --stream; do
+	for pipeline in "" --pipeline; do
+	    label="$stream $pipeline"
+	    bench/runstat -r "$runs" -l "file to /dev/null $label" \
+		-b "$bytes" -- "$bin" --quiet $stream $pipeline "$input"
+	    bench/runstat -r "$runs" -l "file to disk $label" \
+		-b "$bytes" -- "$bin" --quiet $stream $pipeline \
+		--output="$out" "$input"
+	    bench/runstat -r "$runs" -l "pipe to disk $label" \
+		-b "$bytes" -- sh -c "cat '$input' | '$bin' --quiet \
+		$stream $pipeline --output='$out'"
+	done
+    done
+done
+rm -f "$out"
@@ -0,0 +1,154 @@
+/********************************************************************
+ * runstat - run a command several times and report how fast it ran
+ *
+ * USAGE: runstat [-r runs] [-l label] [-i input] [-b bytes] [-n lines]
+ *                -- command...
+ *
+ * The command is run with its standard input redirected from the
+ * given input file (or /dev/null) and its standard output sent to
+ * /dev/null.  The best wall-clock time over all runs is reported,
+ * along with the throughput (bytes is the size of the input unless
+ * given explicitly), the peak resident set size of the command and
+ * the number of read and write system calls it made (as counted by
+ * Linux in /proc/PID/io).  If the number of lines the command writes
+ * is given, the lines written per second are reported too.
+ *
+ * Permission is granted to distribute this software under any version
+ * of the BSD and GPL licenses.
+ *******************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/// The measurements from one run of the command
+struct RunResult{
+  /// Wall clock time in seconds
+  double wall;
+  /// Peak resident set size in kilobytes
+  long max_rss_kb;
+  /// Number of read system calls, -1 if unknown
+  long syscr;
+  /// Number of write system calls, -1 if unknown
+  long syscw;
+};
+
+/// Return the current time in seconds
+static double now(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+/// Run \a argv once with stdin from \a input and return its measurements
+///
+/// Exits the program if the command cannot be run or fails
+static RunResult run_once(char** argv, const char* input){
+  RunResult res;
+  double start = now();
+  pid_t pid = fork();
+  if(pid < 0){
+    perror("runstat: fork");
+    exit(2);
+  }
+  if(pid == 0){
+    int in = open(input, O_RDONLY);
+    int out = open("/dev/null", O_WRONLY);
+    if(in < 0 || out < 0){
+      perror("runstat: open");
+      _exit(127);
+    }
+    dup2(in, 0);
+    dup2(out, 1);
+    execvp(argv[0], argv);
+    perror("runstat: exec");
+    _exit(127);
+  }
+  //Wait without reaping so /proc/PID/io can still be read
+  siginfo_t info;
+  waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+  res.syscr = res.syscw = -1;
+  std::ostringstream io_name;
+  io_name << "/proc/" << pid << "/io";
+  std::ifstream io(io_name.str().c_str());
+  std::string key;
+  long value;
+  while(io >> key >> value){
+    if(key == "syscr:"){ res.syscr = value; }
+    if(key == "syscw:"){ res.syscw = value; }
+  }
+  int status;
+  struct rusage usage;
+  if(wait4(pid, &status, 0, &usage) < 0){
+    perror("runstat: wait4");
+    exit(2);
+  }
+  res.wall = now() - start;
+  res.max_rss_kb = usage.ru_maxrss;
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+    std::cerr << "runstat: command " << argv[0] << " failed\n";
+    exit(2);
+  }
+  return res;
+}
+
+int main(int argc, char** argv){
+  int runs = 3;
+  std::string label;
+  const char* input = "/dev/null";
+  double bytes = -1;
+  double lines = -1;
+  int i;
+  for(i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if(arg == "--"){ ++i; break; }
+    if(i + 1 >= argc){ break; }
+    if(arg == "-r"){ runs = atoi(argv[++i]); }
+    else if(arg == "-l"){ label = argv[++i]; }
+    else if(arg == "-i"){ input = argv[++i]; }
+    else if(arg == "-b"){ bytes = atof(argv[++i]); }
+    else if(arg == "-n"){ lines = atof(argv[++i]); }
+    else{ break; }
+  }
+  if(i >= argc || runs < 1){
+    std::cerr << "Usage: runstat [-r runs] [-l label] [-i input] "
+	      << "[-b bytes] [-n lines] -- command...\n";
+    return 2;
+  }
+  if(bytes < 0){
+    struct stat st;
+    bytes = (stat(input, &st) == 0) ? st.st_size : 0;
+  }
+  if(label.empty()){ label = argv[i]; }
+
+  RunResult best = run_once(argv + i, input);
+  for(int r = 1; r < runs; ++r){
+    RunResult cur = run_once(argv + i, input);
+    if(cur.wall < best.wall){ best.wall = cur.wall; }
+    if(cur.max_rss_kb > best.max_rss_kb){ best.max_rss_kb = cur.max_rss_kb; }
+  }
+  std::cout << std::left << std::setw(24) << label << std::right
+	    << std::fixed << std::setprecision(3)
+	    << std::setw(9) << best.wall << " s "
+	    << std::setprecision(1)
+	    << std::setw(9) << (bytes / 1e6 / best.wall) << " MB/s ";
+  if(lines >= 0){
+    std::cout << std::setprecision(0)
+	      << std::setw(10) << (lines / best.wall) << " lines/s ";
+  }
+  std::cout << std::setw(9) << best.max_rss_kb << " kB peak RSS "
+	    << std::setw(8) << best.syscr << " reads "
+	    << std::setw(8) << best.syscw << " writes\n";
+  return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Grow a copy of the typescript $1 to its full size in a few steps,
+# cutting it at random points, and convert it with --state after each
+# step.  Every output must match a --stream run over the bytes so far,
+# and the last one must match $2.
+input=$1
+expected=$2
+work=tests/55_incremental_work
+size=`wc -c < "$input"`
+awk -v size="$size" 'BEGIN{
+  srand(55)
+  for(trial = 0; trial < 40; ++trial){
+    cuts = ""
+    for(n = 1 + int(rand()*5); n > 0; --n){ cuts = cuts " " int(rand()*size) }
+    print cuts
+  }
+}' | while read cuts; do
+  rm -f $work.state $work.txt
+  for cut in `printf '%s\n' $cuts $size | sort -n`; do
+    head -c $cut "$input" > $work.ts
+    ./typescript2txt --quiet --height=5 --state=$work.state \
+      --output=$work.txt $work.ts || exit 1
+    ./typescript2txt --quiet --height=5 --stream $work.ts > $work.full
+    if ! cmp -s $work.txt $work.full; then
+      echo "incremental output differs after $cut bytes (cuts:$cuts)"
+      exit 1
+    fi
+  done
+  cmp -s $work.txt "$expected" || exit 1
+done || exit 1
+rm -f $work.*
@@ -0,0 +1,35 @@
+/********************************************************************
+ * 57_library - convert standard input with the library interface,
+ * feeding it in pieces of 1 to 7 bytes so that escape sequences,
+ * UTF-8 characters and the script header are split between calls
+ *
+ * USAGE: 57_library [--utf8] < script_output > script.txt
+ *******************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include "typescript2txt.h"
+
+/// Writes each line it receives to standard output
+struct Print: typescript2txt::LineSink{
+  void line(std::string_view text) override{
+    std::cout << text << '\n';
+  }
+};
+
+int main(int argc, char** argv){
+  typescript2txt::Settings settings;
+  settings.utf8 = argc > 1 && std::strcmp(argv[1], "--utf8") == 0;
+  Print print;
+  typescript2txt::Converter conv(print, settings);
+  std::vector<char> input((std::istreambuf_iterator<char>(std::cin)),
+			  std::istreambuf_iterator<char>());
+  std::size_t piece = 1;
+  for(std::size_t i = 0; i < input.size(); i += piece){
+    piece = piece % 7 + 1;
+    conv.feed(&input[i], std::min(piece, input.size() - i));
+  }
+  conv.finish();
+  return 0;
+}
@@ -0,0 +1,313 @@
+/********************************************************************
+ * 62_fuzz - fuzz the Reader, watching for crashes and for inputs
+ * whose processing time grows faster than their length
+ *
+ * USAGE: 62_fuzz file_or_dir...      replay: check every file given
+ *                                    (and every file in every
+ *                                    directory given)
+ *    or: 62_fuzz --quick file        convert one file once (for afl-fuzz:
+ *                                    afl-fuzz -i tests/62_fuzz_corpus
+ *                                    -o findings -- tests/62_fuzz
+ *                                    --quick @@)
+ *    or: 62_fuzz --random=N dir      make N random inputs, saving the
+ *                                    ones that are slow per byte into dir
+ *
+ * Built with -DLIBFUZZER (make fuzz), there is no main and libFuzzer
+ * calls LLVMFuzzerTestOneInput, which aborts on an input that is slow
+ * per byte and whose time grows superlinearly when it is repeated.
+ *
+ * The first three bytes of an input choose the settings: byte 0 bit 0
+ * reads UTF-8, bits 1-2 pick the format (text, html, ansi), bit 3
+ * streams and bits 4-7 the size of the pieces the rest is fed in (0
+ * for all at once); byte 1 is the width less 1 and byte 2 the height
+ * less 1 (modulo 64).  The rest is the typescript.
+ *
+ * The work per byte is measured by converting the typescript repeated
+ * until it is at least base_size bytes long.  Only if that is slower
+ * than slow_ns_per_byte is it converted four times as often too.  A
+ * conversion that is linear in its input takes about four times as
+ * long the second time; growth_limit times as long means something is
+ * at least quadratic.  Times are the CPU time of the converting
+ * thread, and the two lengths are converted in turn, taking the best
+ * of several runs of each, so that a busy machine (e.g. make -j)
+ * does not make a linear input look superlinear.
+ *
+ * Permission is granted to distribute this software under any version
+ * of the BSD and GPL licenses.
+ *******************************************************************/
+
+#define TYPESCRIPT2TXT_LIBRARY
+#include "../typescript2txt.cpp"
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+
+namespace{
+
+/// The least number of bytes whose conversion time is measured
+const std::size_t base_size = 256*1024;
+
+/// The most the time may grow when the input is repeated four times
+const double growth_limit = 10;
+
+/// The time per byte above which an input is checked for growth
+const double slow_ns_per_byte = 200;
+
+/// How many times each length is converted when measuring growth
+const int samples = 5;
+
+/// The CPU time the calling thread has used, in seconds
+double thread_seconds(){
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/// Takes the lines of a conversion, touching every byte of them
+struct Discard: LineSink{
+  /// A sum of the bytes, so that the lines cannot be optimized away
+  std::size_t sum = 0;
+
+  void line(std::string_view text) override{
+    for(char c: text){ sum += static_cast<unsigned char>(c); }
+  }
+};
+
+/// The settings chosen by the first bytes of an input
+struct FuzzSettings{
+  bool utf8;
+  Format format;
+  bool stream;
+  std::size_t piece;
+  std::size_t width;
+  std::size_t height;
+
+  /// Take the settings from the start of [\a data, \a data + \a size)
+  /// and move \a data and \a size past them
+  FuzzSettings(const char*& data, std::size_t& size){
+    unsigned char b[3] = {0, 79, 23};
+    for(int i = 0; i < 3 && size > 0; ++i, ++data, --size){
+      b[i] = static_cast<unsigned char>(*data);
+    }
+    utf8 = b[0] & 1;
+    static const Format formats[] = {
+      typescript2txt::TEXT, typescript2txt::HTML, typescript2txt::ANSI,
+      typescript2txt::TEXT
+    };
+    format = formats[(b[0] >> 1) & 3];
+    stream = b[0] & 8;
+    piece = b[0] >> 4;
+    width = b[1] + 1u;
+    height = b[2] % 64 + 1u;
+  }
+};
+
+/// \brief Convert \a copies copies of the \a size bytes at \a data
+///
+/// \return the seconds of CPU time it took
+double convert(const FuzzSettings& s, const char* data, std::size_t size,
+	       std::size_t copies){
+  const double start = thread_seconds();
+  Reader r;
+  r.set_width(s.width);
+  r.set_height(s.height);
+  r.set_utf8(s.utf8);
+  r.set_format(s.format);
+  r.diagnostics().set_mode(Diagnostics::NONE);
+  Discard out;
+  if(s.stream){
+    r.stream_to(out);
+  }
+  for(std::size_t c = 0; c < copies; ++c){
+    if(s.piece == 0){
+      r.read_from(data, data + size);
+      continue;
+    }
+    for(std::size_t i = 0; i < size; i += s.piece){
+      r.read_from(data + i, data + std::min(size, i + s.piece));
+    }
+  }
+  r.write_to(out);
+  return thread_seconds() - start;
+}
+
+/// What measure found about an input
+struct Measurement{
+  /// Nanoseconds per byte of the longer conversion
+  double ns_per_byte;
+  /// How many times longer the longer conversion took
+  double growth;
+};
+
+/// \brief Measure how the time to convert the input in [\a data, \a
+/// \brief data + \a size) grows with its length
+///
+/// The growth is only measured (and otherwise left 0) if the input
+/// is slower than slow_ns_per_byte when repeated to base_size bytes.
+Measurement measure(const char* data, std::size_t size){
+  FuzzSettings s(data, size);
+  Measurement m = {0, 0};
+  if(size == 0){
+    return m;
+  }
+  const std::size_t copies = (base_size + size - 1) / size;
+  double once = convert(s, data, size, copies);
+  m.ns_per_byte = once * 1e9 / (copies * size);
+  if(m.ns_per_byte <= slow_ns_per_byte){
+    return m;
+  }
+  double four = convert(s, data, size, 4 * copies);
+  for(int i = 1; i < samples; ++i){
+    once = std::min(once, convert(s, data, size, copies));
+    four = std::min(four, convert(s, data, size, 4 * copies));
+  }
+  m.ns_per_byte = four * 1e9 / (4.0 * copies * size);
+  m.growth = four / std::max(once, 1e-9);
+  return m;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* bytes, std::size_t size){
+  const char* data = reinterpret_cast<const char*>(bytes);
+  const char* body = data;
+  std::size_t body_size = size;
+  FuzzSettings s(body, body_size);
+  double seconds = convert(s, body, body_size, 1);
+  if(body_size >= 64 && seconds * 1e9 / body_size > slow_ns_per_byte){
+    Measurement m = measure(data, size);
+    if(m.growth > growth_limit){
+      std::fprintf(stderr, "superlinear: %.0f ns per byte, %.1f times as "
+		   "long for four times the input\n", m.ns_per_byte,
+		   m.growth);
+      std::abort();
+    }
+  }
+  return 0;
+}
+
+#ifndef LIBFUZZER
+
+namespace{
+
+/// Return the contents of the file \a name in \a data, false if unreadable
+bool read_file(const std::string& name, std::string& data){
+  std::ifstream in(name.c_str(), std::ios::binary);
+  if(!in){
+    std::cerr << "ERROR: could not open " << name << "\n";
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(in),
+	      std::istreambuf_iterator<char>());
+  return true;
+}
+
+/// \brief Add \a path to \a files, or every file in it if it is a
+/// \brief directory, sorted by name
+void add_files(const std::string& path, std::vector<std::string>& files){
+  DIR* dir = opendir(path.c_str());
+  if(dir == NULL){
+    files.push_back(path);
+    return;
+  }
+  std::vector<std::string> names;
+  while(struct dirent* e = readdir(dir)){
+    if(e->d_name[0] != '.'){
+      names.push_back(path + "/" + e->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  files.insert(files.end(), names.begin(), names.end());
+}
+
+/// Pieces random inputs are made of: controls, parts of escape
+/// sequences (introducers, parameters, final bytes) and text
+const char* const tokens[] = {
+  "\r", "\n", "\b", "\t", "\x1b" "M", "\x1b" "D", "\x1b" "E", "\x1b" "7",
+  "\x1b" "8", "\x1b" "c", "\x1b%G", "\x1b%@", "\x1b]0;title\x07", "\x9b",
+  "\x1b[", "\x1b[?", "@", "A", "B", "C", "D", "G", "H", "J", "K", "L", "M",
+  "P", "X", "d", "f", "h", "l", "m", "r", "s", "u", ";", "0", "1", "9999",
+  "38;5;", "48;2;1;2;", "word ", "\xe6\x97\xa5", "\xc3", "\xff", "~"
+};
+
+/// Return the next of a sequence of random numbers (xorshift64*)
+uint64_t next_random(uint64_t& state){
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ull;
+}
+
+/// \brief Check \a count random inputs, saving those that are slow per
+/// \brief byte and grow superlinearly in the directory \a dir
+///
+/// Each input is written to dir/current before it is converted, so
+/// after a crash that file holds the input that caused it.
+int run_random(std::size_t count, const std::string& dir){
+  const std::size_t num_tokens = sizeof(tokens) / sizeof(tokens[0]);
+  uint64_t state = 88172645463325252ull;
+  int found = 0;
+  for(std::size_t n = 0; n < count; ++n){
+    std::string input;
+    for(int i = 0; i < 3; ++i){
+      input += static_cast<char>(next_random(state));
+    }
+    std::size_t length = next_random(state) % 64 + 1;
+    for(std::size_t i = 0; i < length; ++i){
+      input += tokens[next_random(state) % num_tokens];
+    }
+    std::ofstream(dir + "/current", std::ios::binary) << input;
+    Measurement m = measure(input.data(), input.size());
+    if(m.growth > growth_limit){
+      std::ostringstream name;
+      name << dir << "/random-" << n;
+      std::ofstream(name.str().c_str(), std::ios::binary) << input;
+      std::cout << name.str() << ": " << m.ns_per_byte << " ns per byte, "
+		<< m.growth << " times as long for four times the input\n";
+      ++found;
+    }
+  }
+  std::remove((dir + "/current").c_str());
+  return found > 0 ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+  std::string data;
+  if(argc == 3 && std::strcmp(argv[1], "--quick") == 0){
+    if(!read_file(argv[2], data)){ return 2; }
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(data.data()),
+			   data.size());
+    return 0;
+  }
+  if(argc == 3 && std::strncmp(argv[1], "--random=", 9) == 0){
+    return run_random(std::strtoul(argv[1] + 9, NULL, 10), argv[2]);
+  }
+  if(argc < 2){
+    std::cerr << "Usage: 62_fuzz file_or_dir...\n"
+	      << "   or: 62_fuzz --quick file\n"
+	      << "   or: 62_fuzz --random=N dir\n";
+    return 2;
+  }
+  std::vector<std::string> files;
+  for(int i = 1; i < argc; ++i){
+    add_files(argv[i], files);
+  }
+  int failures = 0;
+  for(const std::string& name: files){
+    if(!read_file(name, data)){ return 2; }
+    Measurement m = measure(data.data(), data.size());
+    if(m.growth > growth_limit){
+      std::cout << name << ": " << m.ns_per_byte << " ns per byte, "
+		<< m.growth << " times as long for four times the input"
+		<< " (superlinear)\n";
+      ++failures;
+    }
+  }
+  return failures > 0 ? 1 : 0;
+}
+
+#endif
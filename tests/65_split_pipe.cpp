@@ -0,0 +1,74 @@
+/********************************************************************
+ * 65_split_pipe - copy standard input to the pipe on standard output,
+ * cut at the given byte offsets, waiting until the reader has taken
+ * each piece from the pipe before writing the next, so that no read
+ * of the reader gets bytes from both sides of a cut
+ *
+ * USAGE: 65_split_pipe offset... < input | reader
+ *******************************************************************/
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/// \brief Write the \a n bytes at \a p to standard output
+///
+/// \return false if there was an error (which has already been
+///         reported on std::cerr)
+bool write_all(const char* p, std::size_t n){
+  while(n > 0){
+    ssize_t done = write(1, p, n);
+    if(done < 0 && errno == EINTR){
+      continue;
+    }
+    if(done < 0){
+      std::cerr << "ERROR: could not write: " << std::strerror(errno) << "\n";
+      return false;
+    }
+    p += done;
+    n -= done;
+  }
+  return true;
+}
+
+/// \brief Wait until the pipe on standard output is empty
+///
+/// \return false if standard output is not a pipe
+bool wait_until_read(){
+  for(;;){
+    int waiting;
+    if(ioctl(1, FIONREAD, &waiting) != 0){
+      std::cerr << "ERROR: standard output is not a pipe\n";
+      return false;
+    }
+    if(waiting == 0){
+      return true;
+    }
+    usleep(1000);
+  }
+}
+
+int main(int argc, char** argv){
+  std::vector<char> input((std::istreambuf_iterator<char>(std::cin)),
+			  std::istreambuf_iterator<char>());
+  std::size_t start = 0;
+  for(int i = 1; i <= argc; ++i){
+    std::size_t end = i < argc ? std::strtoul(argv[i], NULL, 10) :
+      input.size();
+    end = std::max(start, std::min(end, input.size()));
+    if(!write_all(input.data() + start, end - start)){
+      return 1;
+    }
+    if(i < argc && !wait_until_read()){
+      return 1;
+    }
+    start = end;
+  }
+  return 0;
+}
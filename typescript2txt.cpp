@@ -6,6 +6,11 @@
  * This program converts a script file back into a normal text file
  *
  * USAGE: typescript2txt < script_output > script.txt
+ *    or: typescript2txt [--stream] [--width=N] [--height=N] [--utf8] [--quiet] script_output > script.txt
+ *    or: typescript2txt --format=html|ansi script_output > script.html
+ *    or: typescript2txt --timing=timing_file --at=SECONDS [--index=FILE] script_output > screen.txt
+ *    or: typescript2txt --state=STATE --output=script.txt script_output
+ *    or: typescript2txt --follow script_output
  *
  * Although this does not handle all possible xterm output, it appears
  * to work fairly well for normal output from bash etc. 
@@ -19,7 +24,7 @@
  * http://www.kernel.org/doc/man-pages/online/pages/man4/console_codes.4.html
  * which can be seen in many linux distros as man console_codes
  *
- * It would be easy to support colours if we outputted to e.g. HTML.
+ * Colours and other attributes are kept with --format=html or ansi.
  *
  * John C. McCabe-Dansted (gmatht@gmail.com) 2008
  *
@@ -37,965 +42,6277 @@
 #include <cctype>
 #include <cassert>
 #include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
 #include <stdint.h> 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "typescript2txt.h"
+#ifndef TYPESCRIPT2TXT_LIBRARY
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#endif
 
-/// Reads typescript output for a linuxterm (and maybe xterm?) and
-/// recreates what would be on a very long screen (long enough to hold
-/// everything in the file), ignoring color and other formatting
-/// characters
-class Reader{
-  /// The lines that will be output.
-  std::vector<std::vector<char> > lines;
-  /// The index of the cur
-  std::size_t line_idx;
-  /// The index of the cursor on the current line, where the next
-  /// character will be written.  May be (and very frequently is) one past
-  /// the end of the line.
-  std::size_t char_idx;
+using typescript2txt::LineSink;
+using typescript2txt::Format;
 
-  /// The width (in characters) of the terminal that this Reader emulates
-  const static std::size_t width = 80;
+//Everything but the library interface declared in typescript2txt.h
+//is private to this file
+namespace{
 
-  /// The parameters that are used for the CSI sequences - also used
-  /// by some of the OSC commands
-  std::vector<unsigned> params;
-  
-  /// Enum to specify the different states the reader can be in
-  enum RState{
-    SAW_NOTHING,
-    SAW_ESC, ///ESC ( ^] ) was seen (but no trailing ] or [ )
-    SAW_CSI, ///Control sequence introducer - ESC [ or 0x9B
-    SAW_OSC, ///Operating system command ESC ]
-    SAW_OSC_EAT_2_BEL, ///Ignore all characters until ^G in OSC
-    SAW_OSC_4, ///OSC followed by a 4
-    SAW_OSC_5, ///OSC followed by a 5
-    SAW_OSC_P, ///ESC ] P (will read 7 hex digits)
-    SAW_ESC_NUM, ///   ESC #
-    SAW_ESC_PCT, ///   ESC %
-    SAW_ESC_LPAREN,/// ESC (
-    SAW_ESC_RPAREN, /// ESC )
-    SAW_CSI_LBRACKET /// ESC [ [ or CSI [ (just eats next char)
-  };
+/// \brief Return true if \a c may be a control character in the
+/// \brief SAW_NOTHING state
+///
+/// These are the bytes that have a transition other than printing in
+/// the SAW_NOTHING row of Reader::transitions:
+/// everything below 0x20, DEL and the single byte CSI 0x9B.  All other
+/// bytes are written to the screen as they are.
+static inline bool may_be_control_char(unsigned char c){
+  return c < 0x20 || c == 0x7F || c == 0x9B;
+}
 
-  /// The current state of the reader (in escape code etc.)
-  RState state;
-  
-  /// Return the current line
-  std::vector<char>& cur_line(){ return lines.at(line_idx); }
+/// \brief Return the first byte in [begin, end) for which
+/// \brief may_be_control_char is true or end if there is none
+static const char* find_control_char_scalar(const char* begin, 
+					    const char* end){
+  while(begin != end && !may_be_control_char(*begin)){
+    ++begin;
+  }
+  return begin;
+}
 
-  /// Perform a line-feed, adding blank lines and spaces if necessary
-  void line_feed(){ 
-    ++line_idx;
-    while(line_idx >= lines.size()) {
-       lines.push_back(std::vector<char>());
-    }
-    while(char_idx > cur_line().size()){
-      cur_line().push_back(' ');
+#if defined(__SSE2__)
+/// \brief SSE2 version of find_control_char_scalar, 16 bytes at a time
+static const char* find_control_char_sse2(const char* begin, 
+					  const char* end){
+  const __m128i below_space = _mm_set1_epi8(0x1F);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  const __m128i csi = _mm_set1_epi8((char)0x9B);
+  while(end - begin >= 16){
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    //x <= 0x1F (unsigned) exactly when min(x, 0x1F) == x
+    __m128i hits = _mm_cmpeq_epi8(_mm_min_epu8(x, below_space), x);
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(x, del));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(x, csi));
+    unsigned mask = _mm_movemask_epi8(hits);
+    if(mask != 0){
+      return begin + __builtin_ctz(mask);
     }
+    begin += 16;
   }
+  return find_control_char_scalar(begin, end);
+}
 
-  /// Perform a reverse line-feed - go up one line
-  void reverse_line_feed(){
-    if(line_idx > 0){
-      --line_idx;
-    }else{
-      assert(line_idx == 0); //line_idx should never be negative
-      lines.insert(lines.begin(),std::vector<char>());
+/// \brief AVX2 version of find_control_char_scalar, 32 bytes at a time
+///
+/// Only called when the processor running the program supports AVX2
+__attribute__((target("avx2")))
+static const char* find_control_char_avx2(const char* begin, 
+					  const char* end){
+  const __m256i below_space = _mm256_set1_epi8(0x1F);
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  const __m256i csi = _mm256_set1_epi8((char)0x9B);
+  while(end - begin >= 32){
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i hits = _mm256_cmpeq_epi8(_mm256_min_epu8(x, below_space), x);
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(x, del));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(x, csi));
+    unsigned mask = _mm256_movemask_epi8(hits);
+    if(mask != 0){
+      return begin + __builtin_ctz(mask);
     }
-    while(char_idx > cur_line().size()){
-      cur_line().push_back(' ');
+    begin += 32;
+  }
+  return find_control_char_sse2(begin, end);
+}
+#endif
+
+/// Signature shared by the find_control_char implementations
+typedef const char* (*ControlCharFinder)(const char*, const char*);
+
+/// Return the fastest find_control_char implementation this processor
+/// can run
+static ControlCharFinder choose_control_char_finder(){
+#if defined(__SSE2__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    return find_control_char_avx2;
+  }
+  return find_control_char_sse2;
+#else
+  return find_control_char_scalar;
+#endif
+}
+
+/// \brief Return the first byte in [begin, end) for which
+/// \brief may_be_control_char is true or end if there is none
+static const ControlCharFinder find_control_char =
+  choose_control_char_finder();
+
+/// \brief Return true if \a c is not printable ASCII: the bytes that
+/// \brief end a run of characters in UTF-8 mode
+///
+/// These are the control characters and every byte of a multibyte
+/// UTF-8 sequence (and so the single byte CSI 0x9B, which in UTF-8 is
+/// a continuation byte)
+static inline bool is_special_char(unsigned char c){
+  return c < 0x20 || c >= 0x7F;
+}
+
+/// \brief Return the first byte in [begin, end) for which
+/// \brief is_special_char is true or end if there is none
+static const char* find_special_char_scalar(const char* begin,
+					    const char* end){
+  while(begin != end && !is_special_char(*begin)){
+    ++begin;
+  }
+  return begin;
+}
+
+#if defined(__SSE2__)
+/// \brief SSE2 version of find_special_char_scalar, 16 bytes at a time
+static const char* find_special_char_sse2(const char* begin,
+					  const char* end){
+  const __m128i below_space = _mm_set1_epi8(0x1F);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  while(end - begin >= 16){
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    __m128i hits = _mm_cmpeq_epi8(_mm_min_epu8(x, below_space), x);
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(x, del));
+    //Bytes of 0x80 and up have their top bit set already
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(hits, x));
+    if(mask != 0){
+      return begin + __builtin_ctz(mask);
     }
+    begin += 16;
   }
+  return find_special_char_scalar(begin, end);
+}
 
-  /// Perform a tab: position the cursor at the next tab stop
-  ///
-  /// Since tab-stops cannot be set right now, just puts the cursor at
-  /// the next multiple of 8
-  void tab(){
-    char_idx += (8-(char_idx%8))%8;
+/// \brief AVX2 version of find_special_char_scalar, 32 bytes at a time
+///
+/// Only called when the processor running the program supports AVX2
+__attribute__((target("avx2")))
+static const char* find_special_char_avx2(const char* begin,
+					  const char* end){
+  const __m256i below_space = _mm256_set1_epi8(0x1F);
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  while(end - begin >= 32){
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i hits = _mm256_cmpeq_epi8(_mm256_min_epu8(x, below_space), x);
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(x, del));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(hits, x));
+    if(mask != 0){
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
   }
+  return find_special_char_sse2(begin, end);
+}
+#endif
 
-  /// Perform a carriage return - put the current character index at the beginning of the line
-  void carriage_return(){
-    char_idx = 0;
+/// Return the fastest find_special_char implementation this processor
+/// can run
+static ControlCharFinder choose_special_char_finder(){
+#if defined(__SSE2__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    return find_special_char_avx2;
   }
+  return find_special_char_sse2;
+#else
+  return find_special_char_scalar;
+#endif
+}
 
-  /// Perform a back-space - move back over previous character
-  void back_space(){
-    if(char_idx > 0){
-      --char_idx;
+/// \brief Return the first byte in [begin, end) for which
+/// \brief is_special_char is true or end if there is none
+///
+/// Used on input in UTF-8 mode, and on the text of lines (which holds
+/// no control characters) to find the first byte that is not ASCII.
+static const ControlCharFinder find_special_char =
+  choose_special_char_finder();
+
+/// \brief A range of code points that take up the same number of
+/// \brief columns on a terminal
+struct WidthRange{
+  /// The first code point in the range
+  char32_t first;
+  /// The last code point in the range
+  char32_t last;
+  /// The number of columns each takes: 0 or 2
+  unsigned char width;
+};
+
+/// \brief The code points that do not take up one column, in order
+///
+/// Combining marks and invisible format characters take none (they
+/// join the character before them); East Asian wide and fullwidth
+/// characters and most emoji take two.  Derived from Unicode's
+/// EastAsianWidth.txt and the Mn, Me and Cf categories, like wcwidth.
+static constexpr WidthRange width_ranges[] = {
+  {0x0300,0x036F,0}, {0x0483,0x0489,0}, {0x0591,0x05BD,0},
+  {0x05BF,0x05BF,0}, {0x05C1,0x05C2,0}, {0x05C4,0x05C5,0},
+  {0x05C7,0x05C7,0}, {0x0600,0x0605,0}, {0x0610,0x061A,0},
+  {0x061C,0x061C,0}, {0x064B,0x065F,0}, {0x0670,0x0670,0},
+  {0x06D6,0x06DD,0}, {0x06DF,0x06E4,0}, {0x06E7,0x06E8,0},
+  {0x06EA,0x06ED,0}, {0x070F,0x070F,0}, {0x0711,0x0711,0},
+  {0x0730,0x074A,0}, {0x07A6,0x07B0,0}, {0x07EB,0x07F3,0},
+  {0x0816,0x0819,0}, {0x081B,0x0823,0}, {0x0825,0x0827,0},
+  {0x0829,0x082D,0}, {0x0859,0x085B,0}, {0x08D3,0x0902,0},
+  {0x093A,0x093A,0}, {0x093C,0x093C,0}, {0x0941,0x0948,0},
+  {0x094D,0x094D,0}, {0x0951,0x0957,0}, {0x0962,0x0963,0},
+  {0x0981,0x0981,0}, {0x09BC,0x09BC,0}, {0x09C1,0x09C4,0},
+  {0x09CD,0x09CD,0}, {0x09E2,0x09E3,0}, {0x0A01,0x0A02,0},
+  {0x0A3C,0x0A3C,0}, {0x0A41,0x0A51,0}, {0x0A70,0x0A71,0},
+  {0x0A75,0x0A75,0}, {0x0A81,0x0A82,0}, {0x0ABC,0x0ABC,0},
+  {0x0AC1,0x0AC8,0}, {0x0ACD,0x0ACD,0}, {0x0AE2,0x0AE3,0},
+  {0x0B01,0x0B01,0}, {0x0B3C,0x0B3C,0}, {0x0B3F,0x0B3F,0},
+  {0x0B41,0x0B44,0}, {0x0B4D,0x0B4D,0}, {0x0B56,0x0B56,0},
+  {0x0B62,0x0B63,0}, {0x0B82,0x0B82,0}, {0x0BC0,0x0BC0,0},
+  {0x0BCD,0x0BCD,0}, {0x0C00,0x0C00,0}, {0x0C3E,0x0C40,0},
+  {0x0C46,0x0C56,0}, {0x0C62,0x0C63,0}, {0x0CBC,0x0CBC,0},
+  {0x0CCC,0x0CCD,0}, {0x0CE2,0x0CE3,0}, {0x0D00,0x0D01,0},
+  {0x0D41,0x0D44,0}, {0x0D4D,0x0D4D,0}, {0x0D62,0x0D63,0},
+  {0x0DCA,0x0DCA,0}, {0x0DD2,0x0DD6,0}, {0x0E31,0x0E31,0},
+  {0x0E34,0x0E3A,0}, {0x0E47,0x0E4E,0}, {0x0EB1,0x0EB1,0},
+  {0x0EB4,0x0EBC,0}, {0x0EC8,0x0ECD,0}, {0x0F18,0x0F19,0},
+  {0x0F35,0x0F35,0}, {0x0F37,0x0F37,0}, {0x0F39,0x0F39,0},
+  {0x0F71,0x0F7E,0}, {0x0F80,0x0F84,0}, {0x0F86,0x0F87,0},
+  {0x0F8D,0x0FBC,0}, {0x0FC6,0x0FC6,0}, {0x102D,0x1030,0},
+  {0x1032,0x1037,0}, {0x1039,0x103A,0}, {0x103D,0x103E,0},
+  {0x1058,0x1059,0}, {0x105E,0x1060,0}, {0x1071,0x1074,0},
+  {0x1082,0x1082,0}, {0x1085,0x1086,0}, {0x108D,0x108D,0},
+  {0x109D,0x109D,0}, {0x1100,0x115F,2}, {0x1160,0x11FF,0},
+  {0x135D,0x135F,0}, {0x1712,0x1714,0}, {0x1732,0x1734,0},
+  {0x1752,0x1753,0}, {0x1772,0x1773,0}, {0x17B4,0x17B5,0},
+  {0x17B7,0x17BD,0}, {0x17C6,0x17C6,0}, {0x17C9,0x17D3,0},
+  {0x17DD,0x17DD,0}, {0x180B,0x180E,0}, {0x18A9,0x18A9,0},
+  {0x1920,0x1922,0}, {0x1927,0x1928,0}, {0x1932,0x1932,0},
+  {0x1939,0x193B,0}, {0x1A17,0x1A18,0}, {0x1A1B,0x1A1B,0},
+  {0x1A56,0x1A56,0}, {0x1A58,0x1A60,0}, {0x1A62,0x1A62,0},
+  {0x1A65,0x1A6C,0}, {0x1A73,0x1A7F,0}, {0x1AB0,0x1AFF,0},
+  {0x1B00,0x1B03,0}, {0x1B34,0x1B34,0}, {0x1B36,0x1B3A,0},
+  {0x1B3C,0x1B3C,0}, {0x1B42,0x1B42,0}, {0x1B6B,0x1B73,0},
+  {0x1B80,0x1B81,0}, {0x1BA2,0x1BA5,0}, {0x1BA8,0x1BA9,0},
+  {0x1BAB,0x1BAD,0}, {0x1BE6,0x1BE6,0}, {0x1BE8,0x1BE9,0},
+  {0x1BED,0x1BED,0}, {0x1BEF,0x1BF1,0}, {0x1C2C,0x1C33,0},
+  {0x1C36,0x1C37,0}, {0x1CD0,0x1CD2,0}, {0x1CD4,0x1CE0,0},
+  {0x1CE2,0x1CE8,0}, {0x1CED,0x1CED,0}, {0x1CF4,0x1CF4,0},
+  {0x1CF8,0x1CF9,0}, {0x1DC0,0x1DFF,0}, {0x200B,0x200F,0},
+  {0x202A,0x202E,0}, {0x2060,0x2064,0}, {0x20D0,0x20F0,0},
+  {0x231A,0x231B,2}, {0x2329,0x232A,2}, {0x23E9,0x23EC,2},
+  {0x23F0,0x23F0,2}, {0x23F3,0x23F3,2}, {0x25FD,0x25FE,2},
+  {0x2614,0x2615,2}, {0x2648,0x2653,2}, {0x267F,0x267F,2},
+  {0x2693,0x2693,2}, {0x26A1,0x26A1,2}, {0x26AA,0x26AB,2},
+  {0x26BD,0x26BE,2}, {0x26C4,0x26C5,2}, {0x26CE,0x26CE,2},
+  {0x26D4,0x26D4,2}, {0x26EA,0x26EA,2}, {0x26F2,0x26F3,2},
+  {0x26F5,0x26F5,2}, {0x26FA,0x26FA,2}, {0x26FD,0x26FD,2},
+  {0x2705,0x2705,2}, {0x270A,0x270B,2}, {0x2728,0x2728,2},
+  {0x274C,0x274C,2}, {0x274E,0x274E,2}, {0x2753,0x2755,2},
+  {0x2757,0x2757,2}, {0x2795,0x2797,2}, {0x27B0,0x27B0,2},
+  {0x27BF,0x27BF,2}, {0x2B1B,0x2B1C,2}, {0x2B50,0x2B50,2},
+  {0x2B55,0x2B55,2}, {0x2CEF,0x2CF1,0}, {0x2D7F,0x2D7F,0},
+  {0x2DE0,0x2DFF,0}, {0x2E80,0x3029,2}, {0x302A,0x302D,0},
+  {0x302E,0x303E,2}, {0x3041,0x3098,2}, {0x3099,0x309A,0},
+  {0x309B,0x33FF,2}, {0x3400,0x4DBF,2}, {0x4E00,0x9FFF,2},
+  {0xA000,0xA4CF,2}, {0xA66F,0xA672,0}, {0xA674,0xA67D,0},
+  {0xA69E,0xA69F,0}, {0xA6F0,0xA6F1,0}, {0xA802,0xA802,0},
+  {0xA806,0xA806,0}, {0xA80B,0xA80B,0}, {0xA825,0xA826,0},
+  {0xA8C4,0xA8C5,0}, {0xA8E0,0xA8F1,0}, {0xA926,0xA92D,0},
+  {0xA947,0xA951,0}, {0xA960,0xA97F,2}, {0xA980,0xA982,0},
+  {0xA9B3,0xA9B3,0}, {0xA9B6,0xA9B9,0}, {0xA9BC,0xA9BC,0},
+  {0xA9E5,0xA9E5,0}, {0xAA29,0xAA2E,0}, {0xAA31,0xAA32,0},
+  {0xAA35,0xAA36,0}, {0xAA43,0xAA43,0}, {0xAA4C,0xAA4C,0},
+  {0xAA7C,0xAA7C,0}, {0xAAB0,0xAAB0,0}, {0xAAB2,0xAAB4,0},
+  {0xAAB7,0xAAB8,0}, {0xAABE,0xAABF,0}, {0xAAC1,0xAAC1,0},
+  {0xAAEC,0xAAED,0}, {0xAAF6,0xAAF6,0}, {0xABE5,0xABE5,0},
+  {0xABE8,0xABE8,0}, {0xABED,0xABED,0}, {0xAC00,0xD7A3,2},
+  {0xF900,0xFAFF,2}, {0xFB1E,0xFB1E,0}, {0xFE00,0xFE0F,0},
+  {0xFE10,0xFE19,2}, {0xFE20,0xFE2F,0}, {0xFE30,0xFE6F,2},
+  {0xFEFF,0xFEFF,0}, {0xFF00,0xFF60,2}, {0xFFE0,0xFFE6,2},
+  {0xFFF9,0xFFFB,0}, {0x101FD,0x101FD,0}, {0x16FE0,0x16FE4,2},
+  {0x17000,0x18AFF,2}, {0x1B000,0x1B16F,2}, {0x1D167,0x1D169,0},
+  {0x1D173,0x1D182,0}, {0x1D185,0x1D18B,0}, {0x1D1AA,0x1D1AD,0},
+  {0x1F004,0x1F004,2}, {0x1F0CF,0x1F0CF,2}, {0x1F18E,0x1F18E,2},
+  {0x1F191,0x1F19A,2}, {0x1F200,0x1F251,2}, {0x1F300,0x1F64F,2},
+  {0x1F680,0x1F6FF,2}, {0x1F900,0x1F9FF,2}, {0x1FA70,0x1FAFF,2},
+  {0x20000,0x2FFFD,2}, {0x30000,0x3FFFD,2}, {0xE0001,0xE0001,0},
+  {0xE0020,0xE007F,0}, {0xE0100,0xE01EF,0}
+};
+
+/// Return true if the ranges of width_ranges are in order and apart
+static constexpr bool width_ranges_sorted(){
+  for(std::size_t i = 0; i < sizeof(width_ranges)/sizeof(width_ranges[0]); ++i){
+    if(width_ranges[i].first > width_ranges[i].last){ return false; }
+    if(i > 0 && width_ranges[i-1].last >= width_ranges[i].first){
+      return false;
     }
   }
+  return true;
+}
+static_assert(width_ranges_sorted(), "width_ranges must be sorted for "
+	      "display_width's binary search");
 
-  /// Insert the given character at the current position, not moving
-  ///
-  /// Inserts \a c at the current position.  Does not change the
-  /// current position. If the current character is beyond the end of
-  /// the line, inserts enough spaces so that the character is written
-  /// at the correct position.
-  ///
-  /// \param c The character to insert
-  void insert_char(char c){
-    while(char_idx > cur_line().size()){
-      cur_line().push_back(' ');
+/// \brief Return the number of columns the printable code point \a cp
+/// \brief takes up on a terminal: 0, 1 or 2
+static inline unsigned display_width(char32_t cp){
+  if(cp < width_ranges[0].first){
+    return 1;
+  }
+  const WidthRange* end = width_ranges +
+    sizeof(width_ranges)/sizeof(width_ranges[0]);
+  const WidthRange* r = std::upper_bound
+    (width_ranges, end, cp,
+     [](char32_t c, const WidthRange& w){ return c < w.first; });
+  --r; //The last range starting at or before cp
+  return cp <= r->last ? r->width : 1;
+}
+
+/// \brief Return the length of the UTF-8 sequence starting with the
+/// \brief byte \a lead, or 0 if no sequence can start with it
+static inline unsigned utf8_length(unsigned char lead){
+  if(lead < 0x80){ return 1; }
+  if(lead < 0xC2){ return 0; } //Continuation byte or overlong
+  if(lead < 0xE0){ return 2; }
+  if(lead < 0xF0){ return 3; }
+  if(lead < 0xF5){ return 4; }
+  return 0;
+}
+
+/// \brief Return true if \a second may follow the lead byte \a lead in
+/// \brief a UTF-8 sequence
+///
+/// Besides being a continuation byte, the second byte must not make
+/// the sequence an overlong encoding, a surrogate or above U+10FFFF.
+static inline bool utf8_second_ok(unsigned char lead, unsigned char second){
+  switch(lead){
+  case 0xE0: return second >= 0xA0 && second <= 0xBF;
+  case 0xED: return second >= 0x80 && second <= 0x9F;
+  case 0xF0: return second >= 0x90 && second <= 0xBF;
+  case 0xF4: return second >= 0x80 && second <= 0x8F;
+  default: return (second & 0xC0) == 0x80;
+  }
+}
+
+/// \brief Decode the character at the start of the \a n > 0 bytes at
+/// \brief \a s, put it in \a cp and return the number of bytes it uses
+///
+/// A byte that does not start a valid sequence is returned by itself
+/// (as a code point equal to its value) so text that is not UTF-8 is
+/// still stepped through one byte per column.
+static inline unsigned decode_utf8(const char* s, std::size_t n,
+				   char32_t& cp){
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+  unsigned len = utf8_length(u[0]);
+  if(len <= 1 || len > n || !utf8_second_ok(u[0], u[1])){
+    cp = u[0];
+    return 1;
+  }
+  cp = u[0] & (0x7F >> len);
+  for(unsigned i = 1; i < len; ++i){
+    if((u[i] & 0xC0) != 0x80){
+      cp = u[0];
+      return 1;
     }
-    assert(char_idx <= cur_line().size());
-    if(char_idx == cur_line().size()){
-      cur_line().push_back(c);
-    }else if(char_idx < cur_line().size()){
-      cur_line().insert(char_idx + cur_line().begin(), c);
+    cp = (cp << 6) | (u[i] & 0x3F);
+  }
+  return len;
+}
+
+/// \brief Return the number of columns taken by the character at the
+/// \brief start of the \a n > 0 bytes of line text at \a s and put the
+/// \brief number of bytes it uses in \a len
+///
+/// A byte that is not valid UTF-8 takes one column.
+static inline unsigned char_columns(const char* s, std::size_t n,
+				    unsigned& len){
+  char32_t cp;
+  len = decode_utf8(s, n, cp);
+  return len == 1 && cp >= 0x80 ? 1 : display_width(cp);
+}
+
+/// \brief Return the number of columns the UTF-8 text of \a n bytes at
+/// \brief \a s takes up
+///
+/// Only the part after the leading run of ASCII is decoded.
+static std::size_t count_columns(const char* s, std::size_t n){
+  const char* end = s + n;
+  const char* p = find_special_char(s, end);
+  std::size_t cols = p - s;
+  while(p != end){
+    unsigned len;
+    cols += char_columns(p, end - p, len);
+    p += len;
+  }
+  return cols;
+}
+
+/// The largest width or height of a screen that is accepted
+static const std::size_t max_screen_size = 100000;
+
+/// \brief Return the number after \a field=" in [begin, end), or 0 if
+/// \brief there is none (or it is larger than max_screen_size)
+static std::size_t header_field(const char* begin, const char* end,
+				const std::string& field){
+  const std::string key = field + "=\"";
+  const char* found = std::search(begin, end, key.begin(), key.end());
+  if(found == end){
+    return 0;
+  }
+  std::size_t n = 0;
+  for(const char* p = found + key.size(); p != end && isdigit((unsigned char)*p); ++p){
+    n = n * 10 + (*p - '0');
+    if(n > max_screen_size){ return 0; }
+  }
+  return n;
+}
+
+/// \brief Find the size of the terminal in the header line that the
+/// \brief script command writes at the start of a typescript
+///
+/// util-linux script starts its typescripts with a line like
+///
+///     Script started on 2024-01-02 10:00:00+00:00 [TERM="xterm" 
+///     TTY="/dev/pts/0" COLUMNS="200" LINES="50"]
+///
+/// (all on one line).  Older versions leave out the size.
+///
+/// \param begin the start of the typescript
+///
+/// \param end one past the last byte available
+///
+/// \param cols set to the number of columns, or 0 if not given
+///
+/// \param rows set to the number of lines, or 0 if not given
+///
+/// \return the end of the header line, or NULL if [begin, end) does
+///         not start with a whole header line
+static const char* script_header_size(const char* begin, const char* end,
+				      std::size_t& cols, std::size_t& rows){
+  cols = rows = 0;
+  static const char prefix[] = "Script started on ";
+  const std::size_t prefix_len = sizeof(prefix) - 1;
+  if(std::size_t(end - begin) < prefix_len || 
+     std::memcmp(begin, prefix, prefix_len) != 0){
+    return NULL;
+  }
+  const void* nl = std::memchr(begin, '\n', end - begin);
+  if(nl == NULL){
+    return NULL;
+  }
+  const char* line_end = static_cast<const char*>(nl);
+  cols = header_field(begin, line_end, "COLUMNS");
+  rows = header_field(begin, line_end, "LINES");
+  return line_end;
+}
+
+/// \brief A bounded queue of blocks of bytes passed from one producer
+/// \brief thread to one consumer thread without locks
+///
+/// The blocks are allocated once and reused.  The producer fills the
+/// block at the tail and publishes it; the consumer reads the block at
+/// the head and then releases it.  Each of the two counters is written
+/// by one side only, so publishing or releasing a block is one atomic
+/// store.  A side that finds the queue full (or empty) yields and then
+/// sleeps for a while, so it uses no processor time while it waits for
+/// a slow partner.
+class BlockRing{
+  /// One buffer of the queue
+  struct Block{
+    /// The bytes, block_size of them
+    std::unique_ptr<char[]> data;
+    /// The number of bytes the producer put in data
+    std::size_t size;
+  };
+
+  /// The buffers, used in turn
+  std::vector<Block> blocks;
+
+  /// The size of each buffer
+  std::size_t block_size;
+
+  /// The number of blocks published so far (written by the producer)
+  alignas(64) std::atomic<std::size_t> tail;
+
+  /// The number of blocks released so far (written by the consumer)
+  alignas(64) std::atomic<std::size_t> head;
+
+  /// True once the producer has published its last block
+  std::atomic<bool> closed;
+
+  /// Wait a little, longer the more \a round has been counted up
+  static void back_off(unsigned& round){
+    if(++round < 64){
+      std::this_thread::yield();
     }else{
-      std::cerr << "SERIOUS WARNING: Impossible value for char_idx "
-		<< "in insert_char.  Ignoring.\n"
-		<< issue_report_boilerplate();
+      std::this_thread::sleep_for(std::chrono::microseconds(round < 1024 ? 
+							    50 : 1000));
     }
   }
 
-  /// Set the current character to \a c and advance to the next
-  ///
-  /// Sets the character a the current position to \a c then advances
-  /// the current character to the next position.  If the current
-  /// character is beyond the end of the line, inserts enough spaces
-  /// so that the character is written at the correct position.
-  ///
-  /// \param c The new value of the character at the current position
-  void put_char(char c){
-    if(char_idx >= width){
-      std::cerr << "Warning: cursor beyond bounds of window in put_char.";
-      char_idx = width - 1;
-    }
-    while(char_idx > cur_line().size()){
-      cur_line().push_back(' ');
+  BlockRing(const BlockRing&);
+  BlockRing& operator=(const BlockRing&);
+public:
+  /// Create a queue of \a count blocks of \a size bytes
+  BlockRing(std::size_t count, std::size_t size)
+    :blocks(count),block_size(size),tail(0),head(0),closed(false){
+    for(std::size_t i = 0; i < count; ++i){
+      blocks[i].data.reset(new char[size]);
+      blocks[i].size = 0;
     }
-    assert(char_idx <= cur_line().size());
-    if(char_idx == cur_line().size()){
-      cur_line().push_back(c);
-      ++char_idx;
-      if(char_idx >= width){
-	carriage_return(); line_feed();
-      }
-    }else if(char_idx < cur_line().size()){
-      cur_line().at(char_idx) = c;
-      ++char_idx;
-      if(char_idx >= width){
-	carriage_return(); line_feed();
-      }
-    }else{
-      std::cerr << "SERIOUS WARNING: Impossible value for char_idx "
-		<< "in put_char.  Ignoring.\n"
-		<< issue_report_boilerplate();
+  }
+
+  /// Return the size of each block
+  std::size_t capacity() const{ return block_size; }
+
+  /// \brief Producer: return the block to fill next, waiting until the
+  /// \brief consumer has released one if all are in use
+  char* next_free(){
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    unsigned round = 0;
+    while(t - head.load(std::memory_order_acquire) == blocks.size()){
+      back_off(round);
     }
+    return blocks[t % blocks.size()].data.get();
   }
 
-  /// Set the state to new_state and clear parameter array
-  ///
-  /// Sets the state of the reader to new_state and (since the
-  /// parameter array is in one sense part of the command reading
-  /// state) clear that array.
-  ///
-  /// \param new_state the new state of the reader after set_state
-  void set_state(RState new_state){
-    state = new_state;
-    params.clear();
+  /// Producer: pass the first \a size bytes of the block from next_free on
+  void publish(std::size_t size){
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    blocks[t % blocks.size()].size = size;
+    tail.store(t + 1, std::memory_order_release);
   }
 
+  /// Producer: say that no more blocks will be published
+  void close(){ closed.store(true, std::memory_order_release); }
 
-  /// Print a warning about \a c whose meaning is unknown in the given context
+  /// \brief Consumer: wait for the next block and set \a data and
+  /// \brief \a size to its bytes
   ///
-  /// \param context a string describing the context in which \c is unknown
-  ///
-  /// \param c the character whose meaning is unknown in the given context
-  void unknown_code(std::string context, unsigned char c){
-    using std::cerr;
-    cerr << "Warning: the meaning of the character '";
-    if(!isprint(c)){
-      if(c < 0x20){
-	cerr << '^'  << (c+'@');
-      }else{
-	if(c == 0x7F){
-	  cerr << "DEL";
-	}else{
-	  cerr << "Unknown char";
-	}
+  /// \return false if the producer closed the queue and every block
+  ///         has been read
+  bool next_full(const char*& data, std::size_t& size){
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    unsigned round = 0;
+    while(h == tail.load(std::memory_order_acquire)){
+      if(closed.load(std::memory_order_acquire) && 
+	 h == tail.load(std::memory_order_acquire)){
+	return false;
       }
-      cerr << "' (" << ((unsigned int)c) << " decimal) ";
-    }else{
-      cerr << c << "' ";
+      back_off(round);
     }
-    cerr << "is unknown in the context of a " << context << ".\n";
+    const Block& b = blocks[h % blocks.size()];
+    data = b.data.get();
+    size = b.size;
+    return true;
   }
 
-  /// Return true if the given char is a control character (and process it)
-  ///
-  /// If \a c is a control character, changes the reader's state to
-  /// reflect its having been received and returns true.  Otherwise,
-  /// does nothing and returns false.
-  ///
-  /// \param c the character to identify and process
-  ///
-  /// \return true if c is a control character, false otherwise
-  bool id_and_process_control_char(unsigned char c){
-    if(c >= 0x20 && c != 0x7F && c != 0x9B){ return false; }
-    c = c+'@'; //Make c into a printable character for easier coding
-    switch(c){
-    case 'G': return true;
-    case 'H': back_space(); return true;
-    case 'I': tab(); return true;
-    case 'J': case 'K': case 'L':carriage_return(); line_feed(); return true;
-    case 'M': carriage_return(); return true;
-    case 'N': character_set(1); return true;
-    case 'O': character_set(0); return true;
-    case 'X': case 'Z': set_state(SAW_NOTHING); return true;
-    case '[': set_state(SAW_ESC); return true;
-    case (0x7F+'@'): /*DEL=0x7F*/ return true;
-    case (0x9B+'@'): /*CSI=0x9B*/ set_state(SAW_CSI); return true;
-    default: return false;
-    }
+  /// Consumer: give the block from next_full back to the producer
+  void release(){
+    head.store(head.load(std::memory_order_relaxed) + 1, 
+	       std::memory_order_release);
   }
+};
 
+/// \brief Collects output lines in a large buffer and writes them to a
+/// \brief file descriptor with as few system calls as possible
+///
+/// Each line is copied into the buffer as one block followed by a
+/// newline.  The buffer is written when the next line would not fit;
+/// lines too long for the buffer are written directly together with
+/// it using writev.  A writer can instead hand its full buffers to a
+/// BlockRing, whose blocks another thread writes out.
+class LineWriter: public LineSink{
+  /// The descriptor the output goes to
+  int fd;
+  /// The queue the output goes to instead of fd, NULL for none
+  BlockRing* ring;
+  /// The lines that have not been written yet
+  std::vector<char> buf;
+  /// The number of bytes of buf in use
+  std::size_t used;
+  /// The errno of the first failed write or 0 if none has failed
+  int error;
 
-  /// Performs the insert blank CSI command ESC [ ... @
-  ///
-  /// If not at the end of a line, inserts the number of blanks
-  /// required by \a param.  
-  ///
-  /// At the end of a line, does nothing.
-  ///
-  /// \param params is an array with the parameters passed to the
-  ///               command.  If no parameters are given, inserts one
-  ///               blank.  Otherwise, inserts as many blanks as the
-  ///               value of the first parameter.  Prints a warning if
-  ///               there is more than one parameter.
-  void insert_blank(std::vector<unsigned> params){
-    if(params.size() == 0){
-      params.push_back(1);
-    }else if(params.size() > 1){
-      std::cerr << "Warning: too many arguments given to insert "
-		<< "blank CSI command ESC [ ... @\n"
-		<< "Ignoring extra parameters\n";
-    }
-    if(char_idx >= cur_line().size()){
+  /// Write all of the given pieces, retrying after partial writes
+  void write_all(struct iovec* iov, int count){
+    if(ring != NULL){
+      for(int i = 0; i < count; ++i){
+	const char* data = static_cast<const char*>(iov[i].iov_base);
+	for(std::size_t left = iov[i].iov_len; left > 0; ){
+	  std::size_t n = std::min(left, ring->capacity());
+	  std::memcpy(ring->next_free(), data, n);
+	  ring->publish(n);
+	  data += n;
+	  left -= n;
+	}
+      }
       return;
     }
-    for(unsigned b = 0; b < params.front(); ++b){
-      insert_char(' ');
+    while(count > 0 && error == 0){
+      ssize_t written = writev(fd, iov, count);
+      if(written < 0){
+	if(errno != EINTR){ error = errno; }
+	continue;
+      }
+      while(count > 0 && (std::size_t)written >= iov->iov_len){
+	written -= iov->iov_len;
+	++iov; --count;
+      }
+      if(count > 0){
+	iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+	iov->iov_len -= written;
+      }
     }
   }
+public:
+  /// \brief Create a writer for \a fd with a \a capacity byte buffer.
+  /// \brief A writer for descriptor -1 throws everything away.
+  explicit LineWriter(int fd, std::size_t capacity = 1024*1024)
+    :fd(fd),ring(NULL),buf(fd < 0 ? 0 : capacity),used(0),error(0){}
 
-  /// Performs the cursor up CSI command ESC [ ... A
-  ///
-  /// Moves the cursor up the number of lines required by \a param.
-  /// Does not make new lines above the first line.
-  ///
-  /// \param params is an array with the parameters passed to the
-  ///               command.  If no parameters are given, goes up one
-  ///               line blank.  Otherwise, goes up as many lines as
-  ///               the value of the first parameter.  Prints a
-  ///               warning if there is more than one parameter.  Does
-  ///               not go above the first line
-  void cursor_up(std::vector<unsigned> params){
-    if(params.size() == 0){
-      params.push_back(1);
-    }else if(params.size() > 1){
-      std::cerr << "Warning: too many arguments given to cursor up "
-		<< "CSI command ESC [ ... A\n"
-		<< "Ignoring extra parameters\n";
-    }
-    if(line_idx > params.front()){
-      line_idx -= params.front();
-    }else{
-      line_idx = 0;
+  /// \brief Create a writer that publishes its output in the blocks of
+  /// \brief \a ring, one buffer of ring.capacity() bytes at a time
+  explicit LineWriter(BlockRing& ring)
+    :fd(-1),ring(&ring),buf(ring.capacity()),used(0),error(0){}
+
+  /// Write anything still buffered
+  ~LineWriter(){ flush(); }
+
+  /// Add the \a len characters at \a data and a newline to the output
+  void write_line(const char* data, std::size_t len){
+    if(buf.empty()){
+      return; //Throwing everything away
+    }
+    if(used + len + 1 > buf.size()){
+      if(len + 1 > buf.size()){
+	struct iovec iov[3];
+	iov[0].iov_base = &buf.front(); iov[0].iov_len = used;
+	iov[1].iov_base = const_cast<char*>(data); iov[1].iov_len = len;
+	iov[2].iov_base = const_cast<char*>("\n"); iov[2].iov_len = 1;
+	write_all(iov, 3);
+	used = 0;
+	return;
+      }
+      flush();
     }
+    if(len > 0){
+      std::memcpy(&buf[used], data, len);
+      used += len;
+    }
+    buf[used++] = '\n';
   }
 
-  /// Performs the cursor down CSI command ESC [ ... B
-  ///
-  /// Moves the cursor down the number of lines required by \a param.
-  /// Does not make new lines below the last line.
+  /// Same as write_line, for the reader's committed lines
+  void line(std::string_view text) override{
+    write_line(text.data(), text.size());
+  }
+
+  /// Write everything buffered so far
   ///
-  /// \param params is an array with the parameters passed to the
-  ///               command.  If no parameters are given, goes down one
-  ///               line.  Otherwise, goes down as many lines as
-  ///               the value of the first parameter.  Prints a
-  ///               warning if there is more than one parameter.  Does
-  ///               not go above the first line
-  void cursor_down(std::vector<unsigned> params){
-    if(params.size() == 0){
-      params.push_back(1);
-    }else if(params.size() > 1){
-      std::cerr << "Warning: too many arguments given to cursor down "
-		<< "CSI command ESC [ ... A\n"
-		<< "Ignoring extra parameters\n";
-    }
-    if(line_idx + params.front() < lines.size()){
-      line_idx += params.front();
-    }else{
-      line_idx = params.size() - 1;
+  /// \return true if all writes so far have succeeded
+  bool flush(){
+    if(used > 0){
+      struct iovec iov;
+      iov.iov_base = &buf.front(); iov.iov_len = used;
+      write_all(&iov, 1);
+      used = 0;
     }
+    return error == 0;
   }
 
-  /// Performs the cursor right CSI command ESC [ ... C
-  ///
-  /// Moves the cursor right the number of columns required by \a
-  /// param.
-  /// 
-  ///
-  /// \param params is an array with the parameters passed to the
-  ///               command.  If no parameters are given, goes right one
-  ///               column.  Otherwise, goes right as many columns as
-  ///               the value of the first parameter.  Prints a
-  ///               warning if there is more than one parameter.
-  void cursor_right(std::vector<unsigned> params){
-    if(params.size() == 0){
-      params.push_back(1);
-    }else if(params.size() > 1){
-      std::cerr << "Warning: too many arguments given to cursor right "
-		<< "CSI command ESC [ ... A\n"
-		<< "Ignoring extra parameters\n";
+  /// \brief Write the \a len bytes at \a data as they are, after
+  /// \brief anything buffered
+  void write_raw(const char* data, std::size_t len){
+    struct iovec iov[2];
+    iov[0].iov_base = buf.data(); iov[0].iov_len = used;
+    iov[1].iov_base = const_cast<char*>(data); iov[1].iov_len = len;
+    write_all(used > 0 ? iov : iov + 1, used > 0 ? 2 : 1);
+    used = 0;
+  }
+
+  /// Return the errno of the first failed write or 0 if none failed
+  int write_error() const{ return error; }
+};
+
+/// \brief A double-ended queue kept in one power-of-two sized array
+///
+/// Elements can be added at either end in amortized constant time and
+/// are addressed by their distance from the front in constant time:
+/// the array is used as a circular buffer whose front is at \a head.
+template<class T> class Ring{
+  /// The storage, whose size is always zero or a power of two
+  std::vector<T> buf;
+  /// The position in buf of the first element
+  std::size_t head;
+  /// The number of elements
+  std::size_t count;
+
+  /// Double the size of buf, moving the elements to its start
+  void grow(){
+    std::vector<T> bigger(buf.empty() ? 16 : 2*buf.size());
+    for(std::size_t i = 0; i < count; ++i){
+      bigger[i] = (*this)[i];
     }
-    char_idx += params.front();
+    buf.swap(bigger);
+    head = 0;
   }
+public:
+  /// Create an empty ring
+  Ring():head(0),count(0){}
 
-  /// Performs the delete characters CSI command ESC [ ... P
-  ///
-  /// Removes the number of characters indicated by \a params from the
-  /// line to the right of the current cursor location.  Shifts all
-  /// characters after the one to delete to the left to fill in the gap.
-  /// If the cursor is past the end of the line, does nothing.
+  /// Return the number of elements
+  std::size_t size() const{ return count; }
+
+  /// Return the element \a i places from the front
+  T& operator[](std::size_t i){ return buf[(head + i) & (buf.size() - 1)]; }
+
+  /// Return the element \a i places from the front
+  const T& operator[](std::size_t i) const{
+    return buf[(head + i) & (buf.size() - 1)];
+  }
+
+  /// Add \a x after the last element
+  void push_back(const T& x){
+    if(count == buf.size()){ grow(); }
+    ++count;
+    (*this)[count - 1] = x;
+  }
+
+  /// Add \a x before the first element
+  void push_front(const T& x){
+    if(count == buf.size()){ grow(); }
+    head = (head + buf.size() - 1) & (buf.size() - 1);
+    ++count;
+    (*this)[0] = x;
+  }
+
+  /// Remove the first \a n elements
+  void pop_front(std::size_t n){
+    assert(n <= count);
+    if(n == 0){ return; }
+    head = (head + n) & (buf.size() - 1);
+    count -= n;
+  }
+
+  /// Remove the last \a n elements
+  void pop_back(std::size_t n){
+    assert(n <= count);
+    count -= n;
+  }
+};
+
+/// \brief The text of a sequence of lines, kept in a few large chunks
+/// \brief of memory
+///
+/// Each line is a compact record giving the chunk that holds its
+/// characters, where in the chunk they start, how many there are and
+/// how many fit before the line must move.  New text is allocated from
+/// the end of the newest chunk, so lines written one after the other
+/// are next to each other in memory and the line being written can
+/// usually grow in place.  A line that must grow and cannot is moved
+/// to the end of the newest chunk with twice the room.  A chunk is
+/// freed once no line uses it any more.
+///
+/// Lines are addressed by index.  Lines can be added at either end in
+/// amortized constant time.  Pointers to the text of a line remain
+/// valid until that line grows.
+///
+/// After keep_styles, the store also keeps the style of every
+/// character as a list of spans per line: a span is only added where
+/// the style changes, so a line in one style needs no more memory than
+/// without styles.  The spans follow the characters through every
+/// change to the lines.
+class LineStore{
+public:
+  /// \brief The start of a run of characters in one style: the
+  /// \brief characters from byte \a start of the line to the start of
+  /// \brief the next span (or the end of the line) have style \a style
+  struct Span{
+    /// The position in the line of the first character of the run
+    uint32_t start;
+    /// The number of the style of the run (see StyleTable)
+    uint32_t style;
+  };
+private:
+  /// Where the characters of one line are kept
+  struct Record{
+    /// Index in chunks of the chunk holding the line (if cap > 0)
+    uint32_t chunk;
+    /// Position of the first character of the line in its chunk
+    uint32_t offset;
+    /// The number of characters in the line
+    uint32_t size;
+    /// The number of characters reserved for the line
+    uint32_t cap : 31;
+    /// True if the line may hold bytes that are not ASCII (see
+    /// mark_non_ascii)
+    uint32_t non_ascii : 1;
+  };
+
+  /// A block of memory holding the text of many lines
+  struct Chunk{
+    /// The memory, NULL if this chunk has been freed
+    char* mem;
+    /// The number of bytes at the start of mem that have been handed out
+    std::size_t used;
+    /// The size of mem
+    std::size_t cap;
+    /// The number of lines whose text is in this chunk
+    std::size_t live;
+  };
+
+  /// The size of a normal chunk.  Longer lines get a chunk of their own.
+  static const std::size_t chunk_size = 1024*1024;
+
+  /// Marks that there is no chunk
+  static const uint32_t no_chunk = 0xFFFFFFFF;
+
+  /// One record per line, in order
+  Ring<Record> records;
+
+  /// All chunks, including freed ones, which are reused
+  std::vector<Chunk> chunks;
+
+  /// Indices of the freed chunks in chunks
+  std::vector<uint32_t> free_chunks;
+
+  /// The chunk that new text is allocated from, no_chunk if none
+  uint32_t tail;
+
+  /// A chunk_size block kept from the last freed chunk so streaming
+  /// does not allocate a new block for every chunk; NULL if none
+  char* spare;
+
+  /// The number of characters reserved for a line when it is first
+  /// written (see set_line_reserve)
+  std::size_t line_reserve;
+
+  /// \brief The spans of each line, kept as the text of the same line
+  /// \brief of a second store; NULL unless keep_styles was called
   ///
-  /// \param params is an array with the parameters passed to the
-  ///               command.  If no parameters are given, deletes one
-  ///               character.  Otherwise, deletes as many characters
-  ///               as the value of the first parameter.  Prints a
-  ///               warning if there is more than one parameter.
-  void delete_characters(std::vector<unsigned> params){
-    if(params.size() == 0){
-      params.push_back(1);
-    }else if(params.size() > 1){
-      std::cerr << "Warning: too many arguments given to delete characters "
-		<< "CSI command ESC [ ... P\n"
-		<< "Ignoring extra parameters\n";
+  /// A line with no spans has all its characters in style 0.
+  std::unique_ptr<LineStore> styles;
+
+  /// The style of the characters added by write
+  uint32_t pen;
+
+  /// The spans of the line being changed, while they are changed
+  std::vector<Span> scratch;
+
+  /// Round \a n up to the next multiple of 16
+  static std::size_t round_up(std::size_t n){ return (n + 15) & ~(std::size_t)15; }
+
+  /// Return the memory of a chunk and mark it free
+  void free_chunk(uint32_t id){
+    Chunk& c = chunks[id];
+    if(c.cap == chunk_size && spare == NULL){
+      spare = c.mem;
+    }else{
+      delete[] c.mem;
     }
-    if(params.front() > 0){
-      if(char_idx < cur_line().size()){
-	unsigned chars_to_right = cur_line().size() - char_idx;
-	unsigned chars_to_delete = std::min(chars_to_right, params.front());
-	std::vector<char>::iterator del_first = cur_line().begin()+char_idx;
-	std::vector<char>::iterator del_end = del_first + chars_to_delete;
-	cur_line().erase(del_first, del_end);
-      }
+    c.mem = NULL;
+    free_chunks.push_back(id);
+  }
+
+  /// Forget that \a r uses its chunk, freeing the chunk if unused
+  void release(const Record& r){
+    if(r.cap == 0){ return; }
+    Chunk& c = chunks[r.chunk];
+    --c.live;
+    if(c.live == 0 && r.chunk != tail){
+      free_chunk(r.chunk);
     }
   }
 
-  /// Performs the erase line CSI command ESC [ ... K
-  /// 
-  /// If the parameters array is empty removes all characters in
-  /// cur_line() at or after char_idx. 
-  ///
-  /// If the parameters array holds at least one value, then the first
-  /// value must be 1 or 2.  If the first value is neither 1 or 2,
-  /// then prints a warning and does nothing.
-  /// 
-  /// If the first value is 1, the behavior depends on whether
-  /// char_idx is past the end of the line.  If there are characters
-  /// past char_idx in the line, fills all characters from the
-  /// beginning of the line to char_idx (inclusive) with blanks.
-  /// Otherwise the behavior is identical to if the param value had
-  /// been 2.
-  ///
-  /// If the first value is 2, deletes all characters in the array,
-  /// but leaves char_idx the same.
-  ///
-  /// If there is more than one argument, prints a warning
-  ///
-  /// \param params The parameters passed to the CSI K command - see
-  ///               the main text for a description of behavior
-  void erase_line(std::vector<unsigned> params){
-    if(params.size() == 0){
-      if(char_idx < cur_line().size()){
-	std::vector<char>::iterator erasure_start = cur_line().begin()+char_idx;
-	cur_line().erase(erasure_start, cur_line().end());
-      }
+  /// Start a new tail chunk with room for at least \a n bytes
+  void new_tail(std::size_t n){
+    if(tail != no_chunk && chunks[tail].live == 0){
+      free_chunk(tail);
+    }
+    Chunk c;
+    c.cap = n > chunk_size ? n : chunk_size;
+    if(c.cap == chunk_size && spare != NULL){
+      c.mem = spare;
+      spare = NULL;
     }else{
-      if(params.size() > 1){
-	std::cerr << "Warning: too many arguments given to erase line "
-		  << "CSI command ESC [ ... K\n"
-		  << "Ignoring extra parameters\n";      
-      }
-      unsigned p = params.front();
-      if(p != 1 && p != 2){
-	std::cerr << "Warning: argument " << p << " passed to erase line "
-		  << "CSI command ESC [ ... K\n"
-		  << "The meaning of this argument is unknown.  "
-		  << "Doing nothing.\n";
+      c.mem = new char[c.cap];
+    }
+    c.used = 0;
+    c.live = 0;
+    if(free_chunks.empty()){
+      tail = chunks.size();
+      chunks.push_back(c);
+    }else{
+      tail = free_chunks.back();
+      free_chunks.pop_back();
+      chunks[tail] = c;
+    }
+  }
+
+  /// Make room for at least \a needed characters in \a r
+  void reserve(Record& r, std::size_t needed){
+    if(needed <= r.cap){ return; }
+    assert(needed < 0x80000000u);
+    if(r.cap > 0 && r.chunk == tail){
+      Chunk& c = chunks[tail];
+      std::size_t new_end = r.offset + round_up(needed);
+      if(r.offset + r.cap == c.used && new_end <= c.cap){
+	//The line is the last thing in the tail chunk: grow in place
+	c.used = new_end;
+	r.cap = new_end - r.offset;
 	return;
       }
-      if(p == 2 || (char_idx + 1) >= cur_line().size()){
-	//Delete whole line:
-	//Param was 2 or we are at or past the last character in the line
-	cur_line().clear();
-	return;
-      }else{
-	//Delete chars before and at char_idx when there is at least
-	//one character that won't be deleted
-	assert(p == 1);
-	assert(char_idx + 1 < cur_line().size());
-	std::vector<char>::iterator erasure_start = cur_line().begin();
-	std::fill(erasure_start, erasure_start + char_idx + 1, ' ');
-	return;
+    }
+    std::size_t new_cap = round_up(std::max(needed, r.cap == 0 ? 
+					    line_reserve : (std::size_t)2*r.cap));
+    if(tail == no_chunk || chunks[tail].cap - chunks[tail].used < new_cap){
+      new_tail(new_cap);
+    }
+    Chunk& c = chunks[tail];
+    if(r.size > 0){
+      std::memcpy(c.mem + c.used, text(r), r.size);
+    }
+    release(r);
+    r.chunk = tail;
+    r.offset = c.used;
+    r.cap = new_cap;
+    c.used += new_cap;
+    ++c.live;
+  }
+
+  /// Return the characters of the line described by \a r
+  char* text(const Record& r) const{
+    return r.cap == 0 ? NULL : chunks[r.chunk].mem + r.offset;
+  }
+
+  /// Copy the spans of line \a i to scratch
+  void load_spans(std::size_t i){
+    scratch.resize(span_count(i));
+    if(!scratch.empty()){
+      std::memcpy(&scratch.front(), styles->data(i), styles->length(i));
+    }
+  }
+
+  /// Return the style that scratch gives position \a pos
+  uint32_t scratch_style_at(std::size_t pos) const{
+    std::size_t k = scratch.size();
+    while(k > 0 && scratch[k - 1].start > pos){ --k; }
+    return k == 0 ? 0 : scratch[k - 1].style;
+  }
+
+  /// Return the index of the first span in scratch starting at or
+  /// after \a pos
+  std::size_t scratch_find(std::size_t pos) const{
+    std::size_t k = 0;
+    while(k < scratch.size() && scratch[k].start < pos){ ++k; }
+    return k;
+  }
+
+  /// \brief Make the spans in scratch those of line \a i, leaving out
+  /// \brief spans that change nothing, are replaced by a later span at
+  /// \brief the same position or start beyond the end of the line
+  void store_spans(std::size_t i){
+    std::size_t kept = 0;
+    uint32_t prev = 0;
+    for(std::size_t k = 0; k < scratch.size(); ++k){
+      const Span sp = scratch[k];
+      if(sp.start >= records[i].size){ break; }
+      if((k + 1 < scratch.size() && scratch[k + 1].start == sp.start) ||
+	 sp.style == prev){
+	continue;
       }
+      scratch[kept++] = sp;
+      prev = sp.style;
+    }
+    styles->resize(i, 0, 0);
+    if(kept > 0){
+      styles->write(i, 0, reinterpret_cast<const char*>(&scratch.front()),
+		    kept * sizeof(Span));
     }
   }
 
-  /// \brief Return a string containing instructions for reporting an issue
-  /// \brief with the program
-  ///
-  /// \return a string containing instructions for reporting an issue
-  ///         with the program
-  char const * issue_report_boilerplate(){
-    return "Please submit an issue report to "
-      "https://github.com/RadixSeven/typescript2txt/issues "
-      "and include the file you were processing by following the instructions "
-      "in https://github.com/ned14/Easyshop/issues/1\n";
+  /// Give characters [\a from, \a to) of line \a i the style \a style
+  void paint(std::size_t i, std::size_t from, std::size_t to, 
+	     uint32_t style){
+    const std::size_t n = span_count(i);
+    const Span last = n > 0 ? span(i, n - 1) : Span{0, 0};
+    if(last.start <= from && last.style == style){
+      return; //Already in that style
+    }
+    if((n == 0 || last.start < from) && to >= records[i].size){
+      //The usual case: text in a new style added at the end
+      const Span sp = {uint32_t(from), style};
+      styles->write(i, n * sizeof(Span), 
+		    reinterpret_cast<const char*>(&sp), sizeof(Span));
+      return;
+    }
+    load_spans(i);
+    const Span after = {uint32_t(to), scratch_style_at(to)};
+    std::size_t b = scratch_find(from), e = scratch_find(to + 1);
+    scratch.erase(scratch.begin() + b, scratch.begin() + e);
+    const Span run = {uint32_t(from), style};
+    scratch.insert(scratch.begin() + b, after);
+    scratch.insert(scratch.begin() + b, run);
+    store_spans(i);
   }
 
+  /// \brief Move the spans of line \a i to follow \a count characters
+  /// \brief in style 0 inserted at \a pos
+  void insert_spans(std::size_t i, std::size_t pos, std::size_t count){
+    if(span_count(i) == 0){ return; }
+    load_spans(i);
+    const Span after = {uint32_t(pos + count), scratch_style_at(pos)};
+    const std::size_t b = scratch_find(pos);
+    for(std::size_t k = b; k < scratch.size(); ++k){
+      scratch[k].start += count;
+    }
+    const Span blank = {uint32_t(pos), 0};
+    scratch.insert(scratch.begin() + b, after);
+    scratch.insert(scratch.begin() + b, blank);
+    store_spans(i);
+  }
 
-  /// Do nothing
-  ///
-  /// This function is called to document that a CSI command is
-  /// intentionally not implemented because it is not appropriate to
-  /// generating plain text files.
-  void ignore_CSI(){ }
+  /// \brief Move the spans of line \a i to follow the removal of
+  /// \brief \a count characters at \a pos
+  void erase_spans(std::size_t i, std::size_t pos, std::size_t count){
+    if(span_count(i) == 0){ return; }
+    load_spans(i);
+    const Span after = {uint32_t(pos), scratch_style_at(pos + count)};
+    std::size_t b = scratch_find(pos), e = scratch_find(pos + count + 1);
+    for(std::size_t k = e; k < scratch.size(); ++k){
+      scratch[k].start -= count;
+    }
+    scratch.erase(scratch.begin() + b, scratch.begin() + e);
+    scratch.insert(scratch.begin() + b, after);
+    store_spans(i);
+  }
 
+  /// Remove the spans of line \a i that start beyond its end
+  void truncate_spans(std::size_t i){
+    std::size_t n = span_count(i);
+    while(n > 0 && span(i, n - 1).start >= records[i].size){ --n; }
+    styles->resize(i, n * sizeof(Span), 0);
+  }
 
-  //###################################################
-  //###################################################
-  //###    Unimplemented Codes That Generate Warnings
-  //###################################################
-  //###################################################
+  LineStore(const LineStore&);
+  LineStore& operator=(const LineStore&);
+public:
+  /// Create a store with no lines
+  LineStore():tail(no_chunk),spare(NULL),line_reserve(0),pen(0){}
 
-  /// Print a warning that the given CSI command is unimplemented
-  ///
-  /// Unlike the regular escape codes which all have different
-  /// structrues, I can use a generic warning routine because of the
-  /// simple structure of the CSI codes: list of parameters followed
-  /// by an action character.
-  ///
-  /// This warning lets a programmer just implement the codes needed
-  /// to parse his files and ignore the rest.
-  ///
-  /// This is called for CSI codes that may impact plain text output,
-  /// so someone may want to implement them in the future.
-  ///
-  /// \param code The single character command code that identifies
-  ///             the CSI command.  This would be @ for insert blanks,
-  ///             A for cursor up, etc.
-  ///
-  /// \param descr A longer description of the code
+  ~LineStore(){
+    for(std::size_t i = 0; i < chunks.size(); ++i){
+      delete[] chunks[i].mem;
+    }
+    delete[] spare;
+  }
+
+  /// Return the number of lines
+  std::size_t size() const{ return records.size(); }
+
+  /// \brief Reserve room for \a n characters for each line when it is
+  /// \brief first written
   ///
-  /// \param params The parameters that would have been passed to the code
-  void unimplemented_CSI(char code, std::string descr, 
-			 std::vector<unsigned> params){
-    std::cerr << "Warning: this typescript contains an unimplemented CSI "
-	      << "code \"ESC [ ... " << code << "\".  "
-	      << "The code has description: \"" << descr << "\" and was "
-	      << "passed ";
-    if(params.size() == 0){
-      std::cerr << "no parameters.  ";
-    }else{
-      std::cerr << "The parameters: " << params.at(0);
-      for(std::size_t i=1; i < params.size(); ++i){
-	std::cerr << ", " << params.at(i);
+  /// With \a n the width of the screen, a line that is written from
+  /// left to right never has to be moved to grow.  trim gives back what
+  /// was not used.
+  void set_line_reserve(std::size_t n){ line_reserve = n; }
+
+  /// \brief Keep the style of every character from now on.  The lines
+  /// \brief already in the store have all their characters in style 0.
+  void keep_styles(){
+    if(!styles){
+      styles.reset(new LineStore);
+      for(std::size_t i = 0; i < records.size(); ++i){
+	styles->push_back();
       }
-      std::cerr << ".  ";
     }
-    std::cerr << "Ignoring.\n";
   }
 
+  /// Give the characters that write adds from now on style \a style
+  void set_pen(uint32_t style){ pen = style; }
 
-  /// Execute character set change to \a num - just prints warning right now
-  ///
-  /// \param num the number of the character set to change to
-  void character_set(int num){
-    std::cerr << "Warning: typescript file contains command to change to the "
-	      << "G" << num << " character set.  This command is ignored by "
-	      << "this translator.\n";
+  /// \brief Return the number of spans of line \a i, 0 if all its
+  /// \brief characters are in style 0 or styles are not kept
+  std::size_t span_count(std::size_t i) const{
+    return styles ? styles->length(i) / sizeof(Span) : 0;
   }
 
-  /// Set a horizontal tab stop at the current cursor position
-  /// 
-  /// Right now, does nothing but print a warning
-  void set_htab_stop(){
-    std::cerr << "Warning: typescript file contains tab-stop-changing "
-	      << "commands that are ignored by this translator.\n";
+  /// Return span \a k of line \a i
+  Span span(std::size_t i, std::size_t k) const{
+    Span sp;
+    std::memcpy(&sp, styles->data(i) + k * sizeof(Span), sizeof(Span));
+    return sp;
   }
 
-  /// Save the cursor state for later restoration
+  /// \brief Give back the room reserved for line \a i beyond its
+  /// \brief length
   ///
-  /// Right now, does nothing but print a warning
-  void save_cursor_state(){
-    std::cerr << "Warning: typescript file contains cursor-state-saving "
-	      << "commands that are ignored by this translator.\n";
+  /// Only possible (and only done) when the line is the last thing
+  /// allocated, which is the case for a line that was just written.
+  void trim(std::size_t i){
+    Record& r = records[i];
+    if(r.cap == 0 || r.chunk != tail){ return; }
+    Chunk& c = chunks[tail];
+    if(r.offset + r.cap != c.used){ return; }
+    std::size_t keep = round_up(r.size);
+    c.used = r.offset + keep;
+    r.cap = keep;
+    if(keep == 0){
+      --c.live;
+      r.chunk = no_chunk;
+      r.offset = 0;
+    }
   }
 
-  /// Restore the cursor state for later restoration
-  ///
-  /// Right now, does nothing but print a warning
-  void restore_cursor_state(){
-    std::cerr << "Warning: typescript file contains cursor-state-restoring "
-	      << "commands that are ignored by this translator.\n";
+  /// Add an empty line at the end
+  void push_back(){
+    Record r = {no_chunk, 0, 0, 0, 0};
+    records.push_back(r);
+    if(styles){ styles->push_back(); }
   }
 
-  /// Select character set based on the given \a code which must be @,G, or 8
-  ///
-  /// Right now, does nothing but print a warning
-  ///
-  /// \param code @ selects the default (ISO 646/ISO 8859-1), G and 8
-  ///             select UTF-8
-  void select_character_set(const char code){
-    assert(code == '@' || code == 'G' || code == '8');
-    if(code == '@'){
-      std::cerr << "Warning: typescript contains command to set the "
-		<< "character set to ISO 646/ISO 8859-1.  This is "
-		<< "currently ignored by this translator.\n";
-    }else if(code == 'G' || code == '8'){
-      std::cerr << "Warning: typescript contains command to set the "
-		<< "character set to UTF8.  This is "
-		<< "currently ignored by this translator.\n";
-    }else{
-      std::cerr << "SERIOUS WARNING: Illegal code passed to "
-		<< "select_character_set.  Ignoring.\n"
-		<< issue_report_boilerplate();
-      return;
+  /// Add an empty line before the first line
+  void push_front(){
+    Record r = {no_chunk, 0, 0, 0, 0};
+    records.push_front(r);
+    if(styles){ styles->push_front(); }
+  }
+
+  /// Remove the first \a n lines
+  void erase_front(std::size_t n){
+    for(std::size_t i = 0; i < n; ++i){
+      release(records[i]);
     }
+    records.pop_front(n);
+    if(styles){ styles->erase_front(n); }
   }
 
-  /// Define the character set mapping for G0 or G1 
-  ///
-  /// Right now does nothing but print a warning.
-  ///
-  /// Assumes code is one of B,0,U, or X and g_number is 0 or 1
-  ///
-  /// \param g_number if 0 defines, G0, if 1 defines G1
-  ///
-  /// \param code The character from the escape code indicating which
-  ///             mapping.  From the man page: B = Select default (ISO
-  ///             8859-1 mapping), 0 = Select VT100 graphics mapping,
-  ///             U = Select null mapping - straight to character ROM,
-  ///             K = Select user mapping - the map that is loaded by
-  ///             the utility mapscrn(8).
-  void  define_g_character_set(const unsigned g_number, const char code){
-    assert(code == 'B' || code == '0' || code == 'U' || code == 'K');
-    assert(g_number == 0 || g_number == 1);
-    std::string mapping;
-    switch(code){
-    case 'B': mapping = "ISO 8859-1"; break;
-    case '0': mapping = "VT100 graphics"; break;
-    case 'U': mapping = "the null mapping (straight to character ROM)"; break;
-    case 'K': mapping = "the user mapping (loaded by mapscrn(8))"; break;
-    default:
-      std::cerr << "SERIOUS WARNING: Illegal code passed to "
-		<< "define_g_character_set.  Ignoring."
-		<< issue_report_boilerplate();
-      return;
+  /// Remove the last \a n lines
+  void erase_back(std::size_t n){
+    for(std::size_t i = records.size() - n; i < records.size(); ++i){
+      release(records[i]);
     }
-    char g_char = (g_number == 0?'(':')');
-    std::cerr << "Warning: typescript contains command to define the G" 
-	      << g_number << " character set as " << mapping << "\n"
-	      << "This command -- ESC " << g_char
-	      << ' ' << code << " -- is currently ignored by this translator.";
+    records.pop_back(n);
+    if(styles){ styles->erase_back(n); }
   }
 
-  ///Set the palette entry at \a index to the color described by \a rgb
-  ///
-  /// Right now, just prints a warning
-  ///
-  /// \param index The index of of the palette entry to set 0-15 inclusive
+  /// \brief Move lines \a first + \a n through \a last up \a n places,
+  /// \brief losing lines \a first through \a first + \a n - 1 and
+  /// \brief leaving empty lines at the bottom
   ///
-  /// \param rgb The 24 bit number whose lower 3 bytes describe the
-  ///            red, green, and blue intensities in that order
-  ///            (xxxxxxxxRRRRRRRRGGGGGGGGBBBBBBBB)
-  void set_palette(int index, int rgb){
-    if(rgb & 0xFF000000){
-      std::cerr << "SERIOUS WARNING: Illegal RGB value "
-		<< std::hex << ((unsigned)rgb) << " passed to "
-		<< "set_palette.  Ignoring."
-		<< issue_report_boilerplate();
-      return;
+  /// Only the records of the lines move (O(last - first)), not their
+  /// text.  Lines outside [first, last] are not changed.
+  void scroll_up(std::size_t first, std::size_t last, std::size_t n){
+    assert(first <= last && last < records.size());
+    n = std::min(n, last - first + 1);
+    for(std::size_t i = first; i < first + n; ++i){
+      release(records[i]);
     }
-    if(index < 0 || index > 15){
-      std::cerr << "SERIOUS WARNING: Illegal index value "
-		<< index << " passed to "
-		<< "set_palette.  Ignoring."
-		<< issue_report_boilerplate();
-      return;
+    for(std::size_t i = first; i + n <= last; ++i){
+      records[i] = records[i + n];
     }
-    int r = (rgb >> 16) & 0xFF;
-    int g = (rgb >> 8)  & 0xFF;
-    int b = rgb         & 0xFF;
-    std::cerr << "Warning: typescript contains command to set palette " 
-	      << "entry " << index << " to rgb=("<< r << ',' << g << ','
-	      << b << ")  This command is ignored by this translator.\n";
+    Record empty = {no_chunk, 0, 0, 0, 0};
+    for(std::size_t i = last + 1 - n; i <= last; ++i){
+      records[i] = empty;
+    }
+    if(styles){ styles->scroll_up(first, last, n); }
   }
 
-  /// Reset the palette 
+  /// \brief Move lines \a first through \a last - \a n down \a n
+  /// \brief places, losing the bottom \a n lines and leaving empty
+  /// \brief lines at the top
   ///
-  /// Right now, does nothing but print a warning
-  void reset_palette(){
-    std::cerr << "Warning: typescript contains command to reset the palette.  " 
-	      << "This command is ignored by this translator.\n";
-  }
-public:
-  /// Create an empty reader that has read nothing
-  Reader():line_idx(0),char_idx(0){
-    lines.push_back(std::vector<char>());
+  /// Only the records of the lines move (O(last - first)), not their
+  /// text.  Lines outside [first, last] are not changed.
+  void scroll_down(std::size_t first, std::size_t last, std::size_t n){
+    assert(first <= last && last < records.size());
+    n = std::min(n, last - first + 1);
+    for(std::size_t i = last + 1 - n; i <= last; ++i){
+      release(records[i]);
+    }
+    for(std::size_t i = last; i >= first + n; --i){
+      records[i] = records[i - n];
+    }
+    Record empty = {no_chunk, 0, 0, 0, 0};
+    for(std::size_t i = first; i < first + n; ++i){
+      records[i] = empty;
+    }
+    if(styles){ styles->scroll_down(first, last, n); }
   }
 
-  /// \brief Read from the given typescript output stream using the reader's
-  /// \brief current state
-  void read_from(std::istream& in);
+  /// Return the number of characters in line \a i
+  std::size_t length(std::size_t i) const{ return records[i].size; }
 
-  /// \brief Write the contents of this reader to the given stream
-  ///
-  /// The contents of the reader are the interpreted inputs it has
+  /// Return the characters of line \a i (NULL for a line that has
+  /// never held any)
+  char* data(std::size_t i){ return text(records[i]); }
+
+  /// Return the characters of line \a i (NULL for a line that has
+  /// never held any)
+  const char* data(std::size_t i) const{ return text(records[i]); }
+
+  /// Make line \a i \a n characters long, adding copies of \a fill at
+  /// the end (in style 0) if it grows
+  void resize(std::size_t i, std::size_t n, char fill){
+    Record& r = records[i];
+    if(n == 0){
+      r.non_ascii = 0;
+    }
+    const std::size_t old_size = r.size;
+    if(n > r.size){
+      reserve(r, n);
+      std::memset(text(r) + r.size, fill, n - r.size);
+    }
+    r.size = n;
+    if(styles){
+      if(n < old_size){
+	truncate_spans(i);
+      }else if(n > old_size){
+	paint(i, old_size, n, 0);
+      }
+    }
+  }
+
+  /// Insert \a count copies of \a c (in style 0) before position \a pos
+  /// of line \a i
+  void insert(std::size_t i, std::size_t pos, std::size_t count, char c){
+    Record& r = records[i];
+    assert(pos <= r.size);
+    if(count == 0){ return; }
+    reserve(r, r.size + count);
+    char* t = text(r);
+    std::memmove(t + pos + count, t + pos, r.size - pos);
+    std::memset(t + pos, c, count);
+    r.size += count;
+    if(styles){ insert_spans(i, pos, count); }
+  }
+
+  /// Remove \a count characters starting at position \a pos of line \a i
+  void erase(std::size_t i, std::size_t pos, std::size_t count){
+    Record& r = records[i];
+    assert(pos + count <= r.size);
+    if(count == 0){ return; }
+    char* t = text(r);
+    std::memmove(t + pos, t + pos + count, r.size - pos - count);
+    r.size -= count;
+    if(styles){ erase_spans(i, pos, count); }
+  }
+
+  /// \brief Return true if line \a i may hold bytes that are not ASCII
+  ///
+  /// The store does not look at what is written; this is only true
+  /// if mark_non_ascii was called since the line was last empty.
+  bool non_ascii(std::size_t i) const{ return records[i].non_ascii; }
+
+  /// Note that line \a i may hold bytes that are not ASCII
+  void mark_non_ascii(std::size_t i){ records[i].non_ascii = 1; }
+
+  /// \brief Copy the \a n characters at \a s over line \a i starting at
+  /// \brief position \a pos, lengthening the line if needed.  They get
+  /// \brief the style set by set_pen.
+  void write(std::size_t i, std::size_t pos, const char* s, std::size_t n){
+    Record& r = records[i];
+    assert(pos <= r.size);
+    if(n == 0){ return; }
+    reserve(r, pos + n);
+    std::memcpy(text(r) + pos, s, n);
+    r.size = std::max<std::size_t>(r.size, pos + n);
+    if(styles){ paint(i, pos, pos + n, pen); }
+  }
+};
+
+/// \brief A reference to one line of a LineStore with the parts of the
+/// \brief std::vector interface the Reader uses
+class LineRef{
+  /// The store holding the line
+  LineStore& store;
+  /// The index of the line in store
+  std::size_t idx;
+public:
+  /// Refer to line \a i of \a s
+  LineRef(LineStore& s, std::size_t i):store(s),idx(i){}
+
+  /// Return the number of characters in the line
+  std::size_t size() const{ return store.length(idx); }
+
+  /// Return true if the line has no characters
+  bool empty() const{ return size() == 0; }
+
+  /// Return true if the line may hold bytes that are not ASCII
+  bool non_ascii() const{ return store.non_ascii(idx); }
+
+  /// Note that the line may hold bytes that are not ASCII
+  void mark_non_ascii(){ store.mark_non_ascii(idx); }
+
+  /// Return the characters of the line
+  char* data(){ return store.data(idx); }
+
+  /// Add \a c to the end of the line
+  void push_back(char c){ store.write(idx, size(), &c, 1); }
+
+  /// Insert \a count copies of \a c before position \a pos
+  void insert(std::size_t pos, std::size_t count, char c){
+    store.insert(idx, pos, count, c);
+  }
+
+  /// Remove \a count characters starting at \a pos
+  void erase(std::size_t pos, std::size_t count){ store.erase(idx,pos,count); }
+
+  /// Make the line \a n characters long, padding with \a fill
+  void resize(std::size_t n, char fill){ store.resize(idx, n, fill); }
+
+  /// Remove all characters from the line
+  void clear(){ store.resize(idx, 0, ' '); }
+
+  /// Copy \a n characters from \a s over the line starting at \a pos
+  void write(std::size_t pos, const char* s, std::size_t n){
+    store.write(idx, pos, s, n);
+  }
+
+  /// Replace the \a count characters at \a pos with the \a n at \a s
+  void replace(std::size_t pos, std::size_t count,
+	       const char* s, std::size_t n){
+    if(n < count){
+      erase(pos + n, count - n);
+    }else if(n > count){
+      insert(pos + count, n - count, ' ');
+    }
+    write(pos, s, n);
+  }
+};
+
+/// \brief The attributes of a character set by SGR (CSI ... m):
+/// \brief its colours, boldness and the like
+struct Style{
+  /// The bits of flags
+  enum Flag{
+    BOLD = 1, DIM = 2, ITALIC = 4, UNDERLINE = 8, BLINK = 16,
+    REVERSE = 32, INVISIBLE = 64, STRIKE = 128
+  };
+
+  /// Added to 0xRRGGBB to make a direct colour
+  static const uint32_t rgb = 0x1000000;
+
+  /// The foreground colour: 0 for the default, 1 + n for colour n of
+  /// the 256 colour palette or rgb + 0xRRGGBB
+  uint32_t fg;
+  /// The background colour, in the same form as fg
+  uint32_t bg;
+  /// A combination of Flag values
+  uint32_t flags;
+
+  /// Create the default style
+  Style():fg(0),bg(0),flags(0){}
+
+  bool operator==(const Style& o) const{
+    return fg == o.fg && bg == o.bg && flags == o.flags;
+  }
+  bool operator!=(const Style& o) const{ return !(*this == o); }
+  bool operator<(const Style& o) const{
+    if(fg != o.fg){ return fg < o.fg; }
+    if(bg != o.bg){ return bg < o.bg; }
+    return flags < o.flags;
+  }
+};
+
+/// \brief Return the 0xRRGGBB value xterm uses for \a color (in the
+/// \brief form of Style::fg), \a dflt for the default colour
+static uint32_t color_rgb(uint32_t color, uint32_t dflt){
+  static const uint32_t base[16] = {
+    0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE, 0xCD00CD, 0x00CDCD,
+    0xE5E5E5, 0x7F7F7F, 0xFF0000, 0x00FF00, 0xFFFF00, 0x5C5CFF, 0xFF00FF,
+    0x00FFFF, 0xFFFFFF
+  };
+  if(color == 0){ return dflt; }
+  if(color >= Style::rgb){ return color - Style::rgb; }
+  unsigned n = color - 1;
+  if(n < 16){ return base[n]; }
+  if(n < 232){ //The 6x6x6 colour cube
+    static const uint32_t level[6] = {0, 95, 135, 175, 215, 255};
+    n -= 16;
+    return level[n / 36] << 16 | level[n / 6 % 6] << 8 | level[n % 6];
+  }
+  uint32_t gray = 8 + 10 * (n - 232);
+  return gray << 16 | gray << 8 | gray;
+}
+
+/// Append \a text to \a out with the characters special to HTML escaped
+static void append_html(std::string_view text, std::string& out){
+  std::size_t done = 0;
+  for(std::size_t i = 0; i < text.size(); ++i){
+    const char* entity;
+    switch(text[i]){
+    case '&': entity = "&amp;"; break;
+    case '<': entity = "&lt;"; break;
+    case '>': entity = "&gt;"; break;
+    default: continue;
+    }
+    out.append(text, done, i - done);
+    out += entity;
+    done = i + 1;
+  }
+  out.append(text, done, text.size() - done);
+}
+
+/// \brief Numbers the different styles used in a typescript, so that
+/// \brief a span of a line needs only the number of its style
+///
+/// Style 0 is the default style.  Typescripts use only a handful of
+/// styles, so the table stays small however long they are.
+class StyleTable{
+  /// The styles, by number
+  std::vector<Style> styles;
+  /// The number of each style
+  std::map<Style, uint32_t> numbers;
+  /// The HTML start tag of each style, made when first needed
+  std::vector<std::string> tags;
+  /// The SGR sequence that changes the default style to each style,
+  /// made when first needed
+  std::vector<std::string> sgrs;
+
+  /// Append the SGR parameters that set \a color to \a out
+  ///
+  /// \param base 30 for a foreground colour, 40 for a background one
+  static void color_codes(uint32_t color, unsigned base, std::string& out){
+    if(color == 0){
+      out += std::to_string(base + 9);
+    }else if(color >= Style::rgb){
+      uint32_t v = color - Style::rgb;
+      out += std::to_string(base + 8) + ";2;" + std::to_string(v >> 16) + 
+	';' + std::to_string(v >> 8 & 0xFF) + ';' + std::to_string(v & 0xFF);
+    }else if(color <= 8){
+      out += std::to_string(base + color - 1);
+    }else if(color <= 16){
+      out += std::to_string(base + 60 + color - 9);
+    }else{
+      out += std::to_string(base + 8) + ";5;" + std::to_string(color - 1);
+    }
+  }
+
+  /// \brief Append the SGR parameters that change \a from to \a to
+  /// \brief without a reset, separated and followed by ';', to \a out
+  static void change_codes(const Style& from, const Style& to, 
+			   std::string& out){
+    static const struct{ uint32_t flag; char on, off; } flag_codes[] = {
+      {Style::ITALIC, '3', '3'}, {Style::UNDERLINE, '4', '4'}, 
+      {Style::BLINK, '5', '5'}, {Style::REVERSE, '7', '7'},
+      {Style::INVISIBLE, '8', '8'}, {Style::STRIKE, '9', '9'}
+    };
+    uint32_t on = to.flags & ~from.flags;
+    //22 turns off both bold and dim
+    if(from.flags & ~to.flags & (Style::BOLD | Style::DIM)){
+      out += "22;";
+      on |= to.flags & (Style::BOLD | Style::DIM);
+    }
+    if(on & Style::BOLD){ out += "1;"; }
+    if(on & Style::DIM){ out += "2;"; }
+    for(std::size_t k = 0; k < sizeof(flag_codes)/sizeof(flag_codes[0]); ++k){
+      if(on & flag_codes[k].flag){
+	out += flag_codes[k].on; out += ';';
+      }else if(from.flags & ~to.flags & flag_codes[k].flag){
+	out += '2'; out += flag_codes[k].off; out += ';';
+      }
+    }
+    if(from.fg != to.fg){ color_codes(to.fg, 30, out); out += ';'; }
+    if(from.bg != to.bg){ color_codes(to.bg, 40, out); out += ';'; }
+  }
+public:
+  /// The default foreground colour of HTML output
+  static const uint32_t html_fg = 0xE5E5E5;
+  /// The default background colour of HTML output
+  static const uint32_t html_bg = 0x000000;
+
+  /// Create a table holding only the default style
+  StyleTable():styles(1),tags(1),sgrs(1){ numbers[Style()] = 0; }
+
+  /// Return the number of \a s, adding it to the table if it is new
+  uint32_t number(const Style& s){
+    std::map<Style, uint32_t>::const_iterator it = numbers.find(s);
+    if(it != numbers.end()){ return it->second; }
+    uint32_t n = styles.size();
+    styles.push_back(s);
+    numbers[s] = n;
+    return n;
+  }
+
+  /// \brief Return the HTML start tag giving text style \a n: a span
+  /// \brief element with inline CSS
+  const std::string& html_tag(uint32_t n){
+    if(tags.size() <= n){ tags.resize(n + 1); }
+    std::string& tag = tags[n];
+    if(!tag.empty()){ return tag; }
+    const Style& s = styles[n];
+    uint32_t fg = s.fg, bg = s.bg, fg_dflt = html_fg, bg_dflt = html_bg;
+    if(s.flags & Style::REVERSE){
+      std::swap(fg, bg);
+      std::swap(fg_dflt, bg_dflt);
+    }
+    std::ostringstream css;
+    css << std::hex << std::setfill('0');
+    if(fg != 0 || fg_dflt != html_fg){
+      css << "color:#" << std::setw(6) << color_rgb(fg, fg_dflt) << ';';
+    }
+    if(bg != 0 || bg_dflt != html_bg){
+      css << "background:#" << std::setw(6) << color_rgb(bg, bg_dflt) << ';';
+    }
+    if(s.flags & Style::BOLD){ css << "font-weight:bold;"; }
+    if(s.flags & Style::DIM){ css << "opacity:0.6;"; }
+    if(s.flags & Style::ITALIC){ css << "font-style:italic;"; }
+    if(s.flags & (Style::UNDERLINE | Style::STRIKE)){
+      css << "text-decoration:"
+	  << ((s.flags & Style::UNDERLINE) ? "underline" : "")
+	  << ((s.flags & Style::UNDERLINE) && (s.flags & Style::STRIKE) ? 
+	      " " : "")
+	  << ((s.flags & Style::STRIKE) ? "line-through" : "") << ';';
+    }
+    if(s.flags & Style::INVISIBLE){ css << "visibility:hidden;"; }
+    tag = "<span style=\"" + css.str() + "\">";
+    return tag;
+  }
+
+  /// \brief Append the shortest SGR sequence that changes the style
+  /// \brief from number \a from to number \a to to \a out
+  ///
+  /// Attributes are turned off one by one or with a reset, whichever
+  /// is shorter.
+  void append_sgr(uint32_t from, uint32_t to, std::string& out){
+    if(from == to){ return; }
+    if(to == 0){
+      out += "\x1B[0m";
+      return;
+    }
+    if(sgrs.size() <= to){ sgrs.resize(to + 1); }
+    std::string& set = sgrs[to];
+    if(set.empty()){
+      change_codes(Style(), styles[to], set);
+      set.insert(0, "\x1B[");
+      set.back() = 'm';
+    }
+    if(from == 0){
+      out += set;
+      return;
+    }
+    std::string change;
+    change_codes(styles[from], styles[to], change);
+    if(set.size() < change.size()){
+      //A reset (0;) and then the same as from the default is shorter
+      out += "\x1B[0;";
+      out.append(set, 2, std::string::npos);
+    }else{
+      out += "\x1B[";
+      out.append(change, 0, change.size() - 1);
+      out += 'm';
+    }
+  }
+};
+
+/// \brief The numeric parameters of a control sequence, kept inline so
+/// \brief that reading them never allocates
+///
+/// Holds the first max_params parameters.  Any more are counted (so
+/// size() reports how many were given) but their values are dropped.
+/// Values saturate at max_value instead of wrapping around.
+class CSIParams{
+public:
+  /// The number of parameters whose values are kept
+  static const std::size_t max_params = 16;
+  /// The largest value a parameter can hold
+  static const unsigned max_value = 65535;
+private:
+  /// The values of the first max_params parameters
+  unsigned vals[max_params];
+  /// The number of parameters given, including any that were dropped
+  std::size_t count;
+  /// True if the sequence started with a private marker (? < = or >)
+  bool private_marker;
+public:
+  /// Create an empty parameter list
+  CSIParams():count(0),private_marker(false){}
+
+  /// Return the number of parameters given
+  std::size_t size() const{ return count; }
+
+  /// Return true if more parameters were given than could be kept
+  bool overflow() const{ return count > max_params; }
+
+  /// Return parameter \a i, which must be one of the kept ones
+  unsigned at(std::size_t i) const{ 
+    assert(i < count && i < max_params); 
+    return vals[i]; 
+  }
+
+  /// Return parameter \a i, which must be one of the kept ones
+  unsigned& at(std::size_t i){ 
+    assert(i < count && i < max_params); 
+    return vals[i]; 
+  }
+
+  /// Return the first parameter or \a dflt if there are none
+  unsigned first_or(unsigned dflt) const{ return count == 0 ? dflt : vals[0]; }
+
+  /// Remove all parameters and any private marker
+  void clear(){ count = 0; private_marker = false; }
+
+  /// Note that the sequence started with a private marker
+  void set_private(){ private_marker = true; }
+
+  /// Return true if the sequence started with a private marker
+  bool is_private() const{ return private_marker; }
+
+  /// Add a parameter with the value \a v
+  void push_back(unsigned v){
+    if(count < max_params){
+      vals[count] = v > max_value ? max_value : v;
+    }
+    ++count;
+  }
+
+  /// Append the decimal digit \a d to the last parameter, starting a
+  /// parameter if there is none
+  void add_digit(unsigned d){
+    if(count == 0){
+      push_back(0);
+    }
+    if(count <= max_params){
+      unsigned& v = vals[count - 1];
+      v = (v > (max_value - d)/10) ? max_value : v*10 + d;
+    }
+  }
+
+  /// Handle a ';': end the current parameter and start another
+  void separator(){
+    if(count == 0){
+      push_back(0);
+    }
+    push_back(0);
+  }
+};
+
+/// \brief Write the character \a c to \a out in a form that is
+/// \brief readable even if it is a control character
+///
+/// Printable characters are written as they are, C0 controls as ^X,
+/// DEL as DEL and everything else as a hexadecimal number
+void write_code(std::ostream& out, unsigned c){
+  if(c < 0x80 && isprint(c)){
+    out << (char)c;
+  }else if(c < 0x20){
+    out << '^' << (char)(c+'@');
+  }else if(c == 0x7F){
+    out << "DEL";
+  }else{
+    out << "0x" << std::hex << std::uppercase << c 
+	<< std::dec << std::nouppercase;
+  }
+}
+
+/// Collects the warnings about a typescript
+///
+/// Warnings are identified by a context (a string literal describing
+/// the kind of problem; two warnings have the same context only if
+/// they use the same literal) and a code (usually the character that
+/// caused the problem).  Typescripts from full screen programs repeat
+/// the same few unhandled sequences thousands of times, so only the
+/// first occurrence of each warning is described.  Later ones are
+/// just counted and appear in the summary written at the end.
+class Diagnostics{
+public:
+  /// How the warnings are reported
+  enum Mode{
+    TEXT, ///Describe first occurrences as they happen, then a summary table
+    TSV, ///Only write the summary, as tab separated values
+    NONE ///Write nothing
+  };
+private:
+  /// What is known about one kind of warning
+  struct Entry{
+    /// The number of times the warning was given
+    uint64_t count;
+    /// The position in the input of the first occurrence
+    uint64_t first_offset;
+    /// In deferred mode, the description of the first occurrence
+    std::string message;
+  };
+
+  /// The (context, code) pair identifying a warning
+  typedef std::pair<const char*, unsigned> Key;
+
+  /// The warnings given so far
+  std::map<Key, Entry> entries;
+
+  /// Where the warnings are written
+  std::ostream* out;
+
+  /// How the warnings are written
+  Mode mode;
+
+  /// If true, the descriptions of first occurrences are kept to be
+  /// written by write_first_occurrences instead of written at once
+  bool deferred;
+
+  /// In deferred mode, where the description being reported goes
+  std::ostringstream scratch;
+
+  /// The entry whose description is in scratch, or NULL
+  Entry* pending;
+
+  /// Move the description in scratch to the entry it belongs to
+  void settle(){
+    if(pending != NULL){
+      pending->message = scratch.str();
+      scratch.str("");
+      pending = NULL;
+    }
+  }
+
+  /// Return true if the first occurrence of a came before that of b
+  static bool earlier(const Entry* a, const Entry* b){
+    return a->first_offset < b->first_offset;
+  }
+
+  /// Return true if a should come before b in the summary: most
+  /// frequent first, ties in order of first occurrence
+  static bool more_frequent(const std::pair<Key, Entry>& a, 
+			    const std::pair<Key, Entry>& b){
+    if(a.second.count != b.second.count){ 
+      return a.second.count > b.second.count; 
+    }
+    return a.second.first_offset < b.second.first_offset;
+  }
+public:
+  /// The code to use for warnings that are not about one character
+  static const unsigned no_code = 0xFFFFFFFFu;
+
+  /// Create a collector that writes to \a out in the given \a mode
+  Diagnostics(std::ostream& out = std::cerr, Mode mode = TEXT)
+    :out(&out),mode(mode),deferred(false),pending(NULL){}
+
+  /// Change the way the warnings are written to \a m
+  void set_mode(Mode m){ mode = m; }
+
+  /// Return the way the warnings are written
+  Mode get_mode() const{ return mode; }
+
+  /// Write the warnings to \a o from now on
+  void set_output(std::ostream& o){ out = &o; }
+
+  /// \brief Keep the descriptions of first occurrences instead of
+  /// \brief writing them at once
+  ///
+  /// Used when pieces of one input are read by different readers: the
+  /// warnings of the pieces are combined with absorb and only then
+  /// written (with write_first_occurrences), so that each warning is
+  /// described once, at its first occurrence in the whole input.
+  void defer(){ deferred = true; }
+
+  /// \brief Count one occurrence of the warning (\a context, \a code)
+  /// \brief at byte \a offset of the input
+  ///
+  /// \return the stream on which to finish describing the warning if
+  ///         this is its first occurrence and warnings are being
+  ///         described, NULL otherwise.  The returned stream already
+  ///         has the position of the warning written to it.
+  std::ostream* report(const char* context, unsigned code, uint64_t offset){
+    std::pair<std::map<Key, Entry>::iterator, bool> ins = 
+      entries.insert(std::make_pair(Key(context, code), Entry()));
+    Entry& e = ins.first->second;
+    ++e.count;
+    if(!ins.second){
+      return NULL;
+    }
+    e.first_offset = offset;
+    if(mode != TEXT){
+      return NULL;
+    }
+    std::ostream* o = out;
+    if(deferred){
+      settle();
+      pending = &e;
+      o = &scratch;
+    }
+    *o << "Warning at byte " << offset << ": ";
+    return o;
+  }
+
+  /// \brief Add the warnings collected by \a later, whose input came
+  /// \brief after the input of this collector, to those of this one
+  void absorb(Diagnostics& later){
+    settle();
+    later.settle();
+    for(std::map<Key, Entry>::const_iterator it = later.entries.begin();
+	it != later.entries.end(); ++it){
+      std::pair<std::map<Key, Entry>::iterator, bool> ins = 
+	entries.insert(*it);
+      if(!ins.second){
+	ins.first->second.count += it->second.count;
+      }
+    }
+  }
+
+  /// \brief In deferred mode, write the description of the first
+  /// \brief occurrence of each warning, in the order they happened
+  void write_first_occurrences(){
+    settle();
+    if(mode != TEXT){
+      return;
+    }
+    std::vector<const Entry*> firsts;
+    for(std::map<Key, Entry>::const_iterator it = entries.begin();
+	it != entries.end(); ++it){
+      if(!it->second.message.empty()){
+	firsts.push_back(&it->second);
+      }
+    }
+    std::sort(firsts.begin(), firsts.end(), earlier);
+    for(std::size_t i = 0; i < firsts.size(); ++i){
+      *out << firsts[i]->message;
+    }
+  }
+
+  /// Return the number of warnings given so far
+  uint64_t total() const{
+    uint64_t sum = 0;
+    for(std::map<Key, Entry>::const_iterator it = entries.begin();
+	it != entries.end(); ++it){
+      sum += it->second.count;
+    }
+    return sum;
+  }
+
+  /// \brief Write the table of how often each warning was given.
+  /// \brief Writes nothing if there were no warnings.
+  void summarize(){
+    if(entries.empty() || mode == NONE){
+      return;
+    }
+    std::vector<std::pair<Key, Entry> > sorted(entries.begin(), 
+					       entries.end());
+    std::sort(sorted.begin(), sorted.end(), more_frequent);
+    if(mode == TSV){
+      *out << "count\tfirst_byte\tcode\tcontext\n";
+      for(std::size_t i = 0; i < sorted.size(); ++i){
+	*out << sorted[i].second.count << '\t' 
+	     << sorted[i].second.first_offset << '\t'
+	     << (sorted[i].first.second == no_code ? -1 : 
+		 (long long)sorted[i].first.second) << '\t' 
+	     << sorted[i].first.first << '\n';
+      }
+      return;
+    }
+    *out << "Warning summary: " << total() << " warnings of " 
+	 << sorted.size() << " kinds\n"
+	 << std::setw(12) << "count" << std::setw(14) << "first byte" 
+	 << "  code  context\n";
+    for(std::size_t i = 0; i < sorted.size(); ++i){
+      *out << std::setw(12) << sorted[i].second.count 
+	   << std::setw(14) << sorted[i].second.first_offset << "  ";
+      std::ostringstream code;
+      if(sorted[i].first.second == no_code){
+	code << '-';
+      }else{
+	write_code(code, sorted[i].first.second);
+      }
+      *out << std::left << std::setw(4) << code.str() << std::right
+	   << "  " << sorted[i].first.first << '\n';
+    }
+  }
+};
+
+/// Reads typescript output for a linuxterm (and maybe xterm?) and
+/// recreates what would be on a very long screen (long enough to hold
+/// everything in the file), ignoring color and other formatting
+/// characters
+///
+/// The screen of the terminal is the \a height lines starting at
+/// screen_top.  The lines above it are the scrollback.  Commands that
+/// address the screen (cursor positioning, erasing the display,
+/// inserting and deleting lines and the scroll region) work on those
+/// lines.  Screen lines below the last line in \a lines are blank and
+/// are only added when the cursor moves to them or text is scrolled
+/// into them, so a screen that is not full does not add blank lines to
+/// the output.
+class Reader{
+  /// The lines that will be output.  In streaming mode, only the lines
+  /// that have not been output yet.
+  LineStore lines;
+  /// The index of the cur
+  std::size_t line_idx;
+  /// The index of the cursor on the current line, where the next
+  /// character will be written.  May be (and very frequently is) one past
+  /// the end of the line.
+  std::size_t char_idx;
+
+  /// The width (in columns) of the terminal that this Reader emulates
+  std::size_t width;
+
+  /// Where lines are written as soon as they leave the screen in
+  /// streaming mode.  NULL if not streaming.
+  LineSink* stream_out;
+
+  /// The number of lines on the screen: in streaming mode, lines are
+  /// kept only while they are among the last \a height lines
+  std::size_t height;
+
+  /// The index in \a lines of the top line of the screen
+  std::size_t screen_top;
+
+  /// The first line of the scroll region, counting from 0 at the top
+  /// of the screen
+  std::size_t scroll_top;
+
+  /// The last line of the scroll region, counting from 0 at the top
+  /// of the screen
+  std::size_t scroll_bottom;
+
+  /// The largest line_idx so far
+  std::size_t deepest_line;
+
+  /// The parameters that are used for the CSI sequences - also used
+  /// by some of the OSC commands
+  CSIParams params;
+
+  /// Where the warnings about the typescript are collected
+  Diagnostics diag;
+
+  /// The number of bytes passed to earlier calls of read_from
+  uint64_t bytes_before;
+
+  /// The start of the block being read by read_from
+  const char* block_begin;
+
+  /// The byte being processed by read_from (or the start of the run
+  /// of printable characters being written)
+  const char* pos;
+
+  /// \brief True if something this reader did depended on the lines
+  /// \brief above the first one it saw
+  ///
+  /// Set when the cursor was asked to go above the first line, or the
+  /// screen was addressed while its top was still the first line
+  /// (where a reader that saw the lines before would have had its
+  /// screen elsewhere).  A reader that starts in the middle of the
+  /// input (see parse_parallel) has this set when it needed lines it
+  /// never saw.
+  bool needs_earlier;
+
+  /// \brief True if the input is read as UTF-8 (selected by ESC % G
+  /// \brief or set_utf8), false if each byte is one character
+  ///
+  /// In UTF-8 mode a character may take several bytes of a line's
+  /// text and zero, one or two columns; char_idx always counts columns.
+  bool utf8;
+
+  /// The bytes read so far of a UTF-8 sequence that a block ended in
+  /// the middle of
+  unsigned char utf8_pending[4];
+
+  /// The number of bytes in utf8_pending, 0 if no sequence is pending
+  unsigned utf8_have;
+  
+  /// Enum to specify the different states the reader can be in
+  enum RState{
+    SAW_NOTHING,
+    SAW_ESC, ///ESC ( ^] ) was seen (but no trailing ] or [ )
+    SAW_CSI, ///Control sequence introducer - ESC [ or 0x9B
+    SAW_OSC, ///Operating system command ESC ]
+    SAW_OSC_EAT_2_BEL, ///Ignore all characters until ^G in OSC
+    SAW_OSC_4, ///OSC followed by a 4
+    SAW_OSC_5, ///OSC followed by a 5
+    SAW_OSC_P, ///ESC ] P (will read 7 hex digits)
+    SAW_ESC_NUM, ///   ESC #
+    SAW_ESC_PCT, ///   ESC %
+    SAW_ESC_LPAREN,/// ESC (
+    SAW_ESC_RPAREN, /// ESC )
+    SAW_CSI_LBRACKET, /// ESC [ [ or CSI [ (just eats next char)
+    SAW_CSI_INTERMEDIATE /// CSI followed by an intermediate byte (0x20-0x2F)
+  };
+
+  /// The number of values of RState
+  static const std::size_t num_states = SAW_CSI_INTERMEDIATE + 1;
+
+  /// The current state of the reader (in escape code etc.)
+  RState state;
+
+  /// What read_from does with a byte before changing state
+  enum Action{
+    ACT_NONE, ///Nothing but the state change
+    ACT_PRINT, ///put_chars on the run of printable characters
+    ACT_UTF8, ///read_utf8
+    ACT_BACK_SPACE, ///back_space
+    ACT_TAB, ///tab
+    ACT_NEWLINE, ///carriage_return then line_feed
+    ACT_CARRIAGE_RETURN, ///carriage_return
+    ACT_LINE_FEED, ///line_feed (ESC D, without the carriage return)
+    ACT_REVERSE_LINE_FEED, ///reverse_line_feed
+    ACT_SHIFT_OUT, ///^N: character_set(1)
+    ACT_SHIFT_IN, ///^O: character_set(0)
+    ACT_SET_HTAB_STOP, ///set_htab_stop
+    ACT_SAVE_CURSOR, ///save_cursor_state
+    ACT_RESTORE_CURSOR, ///restore_cursor_state
+    ACT_UNKNOWN, ///unknown_code in the context of the current state
+    ACT_CSI_PRIVATE, ///A private parameter marker ? < = or >
+    ACT_CSI_DIGIT, ///A digit of a CSI parameter
+    ACT_CSI_SEPARATOR, ///; or : between CSI parameters
+    ACT_CSI_INSERT_BLANK, ///insert_blank
+    ACT_CSI_CURSOR_UP, ///cursor_up
+    ACT_CSI_CURSOR_DOWN, ///cursor_down
+    ACT_CSI_CURSOR_RIGHT, ///cursor_right
+    ACT_CSI_ERASE_LINE, ///erase_line
+    ACT_CSI_DELETE_CHARACTERS, ///delete_characters
+    ACT_CSI_CURSOR_POSITION, ///cursor_position
+    ACT_CSI_LINE_POSITION, ///line_position
+    ACT_CSI_COLUMN_POSITION, ///column_position
+    ACT_CSI_ERASE_DISPLAY, ///erase_display
+    ACT_CSI_INSERT_LINES, ///insert_lines
+    ACT_CSI_DELETE_LINES, ///delete_lines
+    ACT_CSI_SET_SCROLL_REGION, ///set_scroll_region
+    ACT_CSI_SELECT_GRAPHIC_RENDITION, ///select_graphic_rendition
+    ACT_CSI_UNIMPLEMENTED, ///unimplemented_CSI
+    ACT_SELECT_CHARACTER_SET, ///select_character_set
+    ACT_SCREEN_ALIGNMENT, ///ESC # 8: warn that it is ignored
+    ACT_DEFINE_G0, ///define_g_character_set(0, ...)
+    ACT_DEFINE_G1, ///define_g_character_set(1, ...)
+    ACT_RESET_PALETTE, ///reset_palette
+    ACT_PALETTE_DIGIT ///palette_digit
+  };
+
+  /// What to do with one byte in one state
+  struct Transition{
+    /// The Action to perform
+    unsigned char action;
+    /// The RState to change to afterwards (clearing the parameters)
+    /// or STAY to keep the current state and parameters
+    unsigned char next;
+  };
+
+  /// Transition::next value meaning that the state does not change
+  static const unsigned char STAY = 0xFF;
+
+  /// The transition for every byte in every state
+  typedef std::array<std::array<Transition, 256>, num_states> 
+    TransitionTable;
+
+  /// Return a Transition performing \a a then changing to \a next
+  static constexpr Transition to(Action a, unsigned char next){
+    return Transition{(unsigned char)a, next};
+  }
+
+  /// \brief Build the table read_from uses to decide what to do with
+  /// \brief each byte
+  ///
+  /// Evaluated by the compiler, so there is no cost at run time.
+  ///
+  /// Control sequences are classified as described in ECMA-48: after
+  /// the CSI come parameter bytes (0x30-0x3F), then intermediate bytes
+  /// (0x20-0x2F) and finally one final byte (0x40-0x7E) that names the
+  /// command.  A final byte that is not understood ends the sequence
+  /// with a warning, as does any final byte after intermediates, since
+  /// those select a different command.
+  ///
+  /// In the table for UTF-8 mode (\a utf8 true), every byte above 0x7F
+  /// starts or continues a UTF-8 sequence, so none of them is the
+  /// single byte CSI.
+  static constexpr TransitionTable make_transitions(bool utf8){
+    TransitionTable t{};
+    for(std::size_t s = 0; s < num_states; ++s){
+      for(unsigned c = 0; c < 256; ++c){
+	t[s][c] = to(ACT_UNKNOWN, SAW_NOTHING);
+      }
+    }
+    for(unsigned c = 0; c < 256; ++c){
+      t[SAW_NOTHING][c] = to(ACT_PRINT, STAY);
+      t[SAW_OSC_EAT_2_BEL][c] = to(ACT_NONE, STAY);
+      t[SAW_OSC_4][c] = to(ACT_UNKNOWN, SAW_OSC_EAT_2_BEL);
+      t[SAW_OSC_5][c] = to(ACT_UNKNOWN, SAW_OSC_EAT_2_BEL);
+      t[SAW_OSC_P][c] = to(ACT_UNKNOWN, STAY);
+      t[SAW_CSI_LBRACKET][c] = to(ACT_NONE, SAW_NOTHING);
+    }
+
+    //Escape: ESC ( ^[ )
+    t[SAW_ESC]['c'] = to(ACT_NONE, SAW_NOTHING); //Terminal reset
+    t[SAW_ESC]['D'] = to(ACT_LINE_FEED, SAW_NOTHING);
+    t[SAW_ESC]['E'] = to(ACT_NEWLINE, SAW_NOTHING);
+    t[SAW_ESC]['H'] = to(ACT_SET_HTAB_STOP, SAW_NOTHING);
+    t[SAW_ESC]['M'] = to(ACT_REVERSE_LINE_FEED, SAW_NOTHING);
+    t[SAW_ESC]['Z'] = to(ACT_NONE, SAW_NOTHING); //DEC identification request
+    t[SAW_ESC]['7'] = to(ACT_SAVE_CURSOR, SAW_NOTHING);
+    t[SAW_ESC]['8'] = to(ACT_RESTORE_CURSOR, SAW_NOTHING);
+    t[SAW_ESC]['['] = to(ACT_NONE, SAW_CSI);
+    t[SAW_ESC]['%'] = to(ACT_NONE, SAW_ESC_PCT);
+    t[SAW_ESC]['#'] = to(ACT_NONE, SAW_ESC_NUM);
+    t[SAW_ESC]['('] = to(ACT_NONE, SAW_ESC_LPAREN);
+    t[SAW_ESC][')'] = to(ACT_NONE, SAW_ESC_RPAREN);
+    t[SAW_ESC]['>'] = to(ACT_NONE, SAW_NOTHING); //Numeric keypad mode
+    t[SAW_ESC]['='] = to(ACT_NONE, SAW_NOTHING); //Application keypad mode
+    t[SAW_ESC][']'] = to(ACT_NONE, SAW_OSC);
+
+    //Control sequence: CSI params intermediates final
+    for(unsigned c = 0; c < 0x20; ++c){
+      t[SAW_CSI][c] = to(ACT_UNKNOWN, STAY);
+      t[SAW_CSI_INTERMEDIATE][c] = to(ACT_UNKNOWN, STAY);
+    }
+    for(unsigned c = 0x20; c < 0x30; ++c){
+      t[SAW_CSI][c] = to(ACT_NONE, SAW_CSI_INTERMEDIATE);
+      t[SAW_CSI_INTERMEDIATE][c] = to(ACT_NONE, STAY);
+    }
+    for(unsigned c = 0x30; c < 0x40; ++c){
+      t[SAW_CSI_INTERMEDIATE][c] = to(ACT_NONE, STAY); //Malformed: skip
+    }
+    for(unsigned c = '0'; c <= '9'; ++c){
+      t[SAW_CSI][c] = to(ACT_CSI_DIGIT, STAY);
+    }
+    t[SAW_CSI][';'] = to(ACT_CSI_SEPARATOR, STAY);
+    t[SAW_CSI][':'] = to(ACT_CSI_SEPARATOR, STAY);
+    t[SAW_CSI]['?'] = to(ACT_CSI_PRIVATE, STAY);
+    t[SAW_CSI]['<'] = to(ACT_CSI_PRIVATE, STAY);
+    t[SAW_CSI]['='] = to(ACT_CSI_PRIVATE, STAY);
+    t[SAW_CSI]['>'] = to(ACT_CSI_PRIVATE, STAY);
+    t[SAW_CSI]['@'] = to(ACT_CSI_INSERT_BLANK, SAW_NOTHING);
+    t[SAW_CSI]['A'] = to(ACT_CSI_CURSOR_UP, SAW_NOTHING);
+    t[SAW_CSI]['B'] = to(ACT_CSI_CURSOR_DOWN, SAW_NOTHING);
+    t[SAW_CSI]['C'] = to(ACT_CSI_CURSOR_RIGHT, SAW_NOTHING);
+    t[SAW_CSI]['K'] = to(ACT_CSI_ERASE_LINE, SAW_NOTHING);
+    t[SAW_CSI]['P'] = to(ACT_CSI_DELETE_CHARACTERS, SAW_NOTHING);
+    t[SAW_CSI]['H'] = to(ACT_CSI_CURSOR_POSITION, SAW_NOTHING);
+    t[SAW_CSI]['f'] = to(ACT_CSI_CURSOR_POSITION, SAW_NOTHING);
+    t[SAW_CSI]['d'] = to(ACT_CSI_LINE_POSITION, SAW_NOTHING);
+    t[SAW_CSI]['G'] = to(ACT_CSI_COLUMN_POSITION, SAW_NOTHING);
+    t[SAW_CSI]['`'] = to(ACT_CSI_COLUMN_POSITION, SAW_NOTHING);
+    t[SAW_CSI]['J'] = to(ACT_CSI_ERASE_DISPLAY, SAW_NOTHING);
+    t[SAW_CSI]['L'] = to(ACT_CSI_INSERT_LINES, SAW_NOTHING);
+    t[SAW_CSI]['M'] = to(ACT_CSI_DELETE_LINES, SAW_NOTHING);
+    t[SAW_CSI]['r'] = to(ACT_CSI_SET_SCROLL_REGION, SAW_NOTHING);
+    const char unimplemented[] = "DEFXaeghlnsu";
+    for(const char* u = unimplemented; *u; ++u){
+      t[SAW_CSI][(unsigned char)*u] = to(ACT_CSI_UNIMPLEMENTED, SAW_NOTHING);
+    }
+    t[SAW_CSI]['c'] = to(ACT_NONE, SAW_NOTHING); //VT102 identification
+    t[SAW_CSI]['m'] = to(ACT_CSI_SELECT_GRAPHIC_RENDITION, SAW_NOTHING);
+    t[SAW_CSI]['q'] = to(ACT_NONE, SAW_NOTHING); //Keyboard LEDs
+    t[SAW_CSI]['T'] = to(ACT_NONE, SAW_NOTHING); //Mouse tracking (ctlseqs)
+    t[SAW_CSI]['x'] = to(ACT_NONE, SAW_NOTHING); //Terminal parameters
+    t[SAW_CSI]['['] = to(ACT_NONE, SAW_CSI_LBRACKET);
+
+    //The two byte escapes ESC % x, ESC # x, ESC ( x and ESC ) x
+    t[SAW_ESC_PCT]['@'] = to(ACT_SELECT_CHARACTER_SET, SAW_NOTHING);
+    t[SAW_ESC_PCT]['G'] = to(ACT_SELECT_CHARACTER_SET, SAW_NOTHING);
+    t[SAW_ESC_PCT]['8'] = to(ACT_SELECT_CHARACTER_SET, SAW_NOTHING);
+    t[SAW_ESC_NUM]['8'] = to(ACT_SCREEN_ALIGNMENT, SAW_NOTHING);
+    const char g_sets[] = "B0UK";
+    for(const char* g = g_sets; *g; ++g){
+      t[SAW_ESC_LPAREN][(unsigned char)*g] = to(ACT_DEFINE_G0, SAW_NOTHING);
+      t[SAW_ESC_RPAREN][(unsigned char)*g] = to(ACT_DEFINE_G1, SAW_NOTHING);
+    }
+
+    //Operating system commands: ESC ] ...
+    t[SAW_OSC]['P'] = to(ACT_NONE, SAW_OSC_P);
+    t[SAW_OSC]['R'] = to(ACT_RESET_PALETTE, SAW_NOTHING);
+    t[SAW_OSC]['0'] = to(ACT_NONE, SAW_OSC_EAT_2_BEL);
+    t[SAW_OSC]['1'] = to(ACT_NONE, SAW_OSC_EAT_2_BEL);
+    t[SAW_OSC]['2'] = to(ACT_NONE, SAW_OSC_EAT_2_BEL);
+    t[SAW_OSC]['4'] = to(ACT_NONE, SAW_OSC_4);
+    t[SAW_OSC]['5'] = to(ACT_NONE, SAW_OSC_5);
+    t[SAW_OSC_4]['6'] = to(ACT_NONE, SAW_OSC_EAT_2_BEL);
+    t[SAW_OSC_5]['0'] = to(ACT_NONE, SAW_OSC_EAT_2_BEL);
+    for(unsigned c = '0'; c <= '9'; ++c){
+      t[SAW_OSC_P][c] = to(ACT_PALETTE_DIGIT, STAY);
+    }
+    for(unsigned c = 'A'; c <= 'F'; ++c){
+      t[SAW_OSC_P][c] = to(ACT_PALETTE_DIGIT, STAY);
+    }
+    t[SAW_OSC_EAT_2_BEL]['\x07'] = to(ACT_NONE, SAW_NOTHING);
+
+    //Control characters do the same thing in every state except while
+    //eating an operating system command up to its ^G
+    for(std::size_t s = 0; s < num_states; ++s){
+      if(s == SAW_OSC_EAT_2_BEL){ continue; }
+      t[s][0x07] = to(ACT_NONE, STAY); //^G bell
+      t[s][0x08] = to(ACT_BACK_SPACE, STAY);
+      t[s][0x09] = to(ACT_TAB, STAY);
+      t[s][0x0A] = to(ACT_NEWLINE, STAY);
+      t[s][0x0B] = to(ACT_NEWLINE, STAY);
+      t[s][0x0C] = to(ACT_NEWLINE, STAY);
+      t[s][0x0D] = to(ACT_CARRIAGE_RETURN, STAY);
+      t[s][0x0E] = to(ACT_SHIFT_OUT, STAY);
+      t[s][0x0F] = to(ACT_SHIFT_IN, STAY);
+      t[s][0x18] = to(ACT_NONE, SAW_NOTHING); //^X cancel
+      t[s][0x1A] = to(ACT_NONE, SAW_NOTHING); //^Z substitute
+      t[s][0x1B] = to(ACT_NONE, SAW_ESC);
+      t[s][0x7F] = to(ACT_NONE, STAY); //DEL
+      if(!utf8){
+	t[s][0x9B] = to(ACT_NONE, SAW_CSI); //Single byte CSI
+      }
+    }
+    if(utf8){
+      for(unsigned c = 0x80; c < 256; ++c){
+	t[SAW_NOTHING][c] = to(ACT_UTF8, STAY);
+      }
+    }
+    return t;
+  }
+
+  /// The transitions read_from uses, built by make_transitions
+  static const TransitionTable transitions;
+
+  /// The transitions read_from uses in UTF-8 mode
+  static const TransitionTable utf8_transitions;
+
+  /// transitions or utf8_transitions, whichever is in use
+  const TransitionTable* table;
+
+  /// \brief Return the end of the run of bytes starting at a byte whose
+  /// \brief action is ACT_PRINT: find_control_char or, in UTF-8 mode,
+  /// \brief find_special_char
+  ControlCharFinder find_run_end;
+
+  /// True if the width is to be taken from the script header, if the
+  /// input starts with one (see size_from_header)
+  bool header_width;
+
+  /// True if the height is to be taken from the script header, if the
+  /// input starts with one
+  bool header_height;
+
+  /// How lines are written
+  Format format;
+
+  /// The styles of the characters, if format is not TEXT
+  StyleTable styles;
+
+  /// The style set by the last SGR sequence
+  Style pen;
+
+  /// Where output_line puts a line with its styles marked
+  std::string marked;
+
+  /// Return a description of the escape code being read in \a s for
+  /// use in warnings
+  static const char* state_context(RState s){
+    switch(s){
+    case SAW_CSI: return "control sequence (0x9B or ESC [)";
+    case SAW_CSI_INTERMEDIATE: 
+      return "control sequence with intermediate bytes";
+    case SAW_ESC_PCT: return "character set select command ESC %";
+    case SAW_ESC_NUM: return "DEC screen alignment command ESC #";
+    case SAW_ESC_LPAREN: return "define G0 character set command ESC (";
+    case SAW_ESC_RPAREN: return "define G1 character set command ESC )";
+    case SAW_OSC: return "operating system command ESC ]";
+    case SAW_OSC_4: return "operating system command number 4 (ESC ] 4)";
+    case SAW_OSC_5: return "operating system command number 5 (ESC ] 5)";
+    case SAW_OSC_P: return "palette set command ESC ] P";
+    default: return "escape";
+    }
+  }
+
+  /// Return the description of the unimplemented CSI command \a code
+  static const char* csi_description(char code){
+    switch(code){
+    case 'D': return "Cursor left";
+    case 'E': return "Cursor down and to column 1";
+    case 'F': return "Cursor up and to column 1";
+    case 'X': return "Erase chars";
+    case 'a': return "Cursor right";
+    case 'e': return "Cursor down";
+    case 'g': return "Clear tab stop";
+    case 'h': return "Set mode";
+    case 'l': return "Reset mode";
+    case 'n': return "Device status report";
+    case 's': return "Save cursor location";
+    case 'u': return "Restore cursor location";
+    default: return "Unknown";
+    }
+  }
+  
+  /// Return the current line
+  LineRef cur_line(){ 
+    assert(line_idx < lines.size());
+    return LineRef(lines, line_idx);
+  }
+
+  /// Return the number of columns the current line takes up
+  std::size_t line_columns(){
+    LineRef line = cur_line();
+    if(line.non_ascii()){
+      return count_columns(line.data(), line.size());
+    }
+    return line.size();
+  }
+
+  /// \brief Return the position in the text of the current line of the
+  /// \brief character in column \a col, or the end of the text if the
+  /// \brief line does not reach \a col
+  ///
+  /// On a line without UTF-8 characters that is just \a col.  On one
+  /// with them (even outside UTF-8 mode, once a line holds them a byte
+  /// is no longer a column) characters
+  /// that take no columns belong to the column before them, so they
+  /// come before the returned position.  A wide character covering \a
+  /// col without starting there is first replaced by spaces, as a
+  /// terminal does when half of one is overwritten, so that a character
+  /// always starts at the returned position.
+  std::size_t cell_start(std::size_t col){
+    LineRef line = cur_line();
+    const std::size_t n = line.size();
+    if(!line.non_ascii()){
+      return std::min(col, n);
+    }
+    const char* s = line.data();
+    std::size_t pos = find_special_char(s, s + std::min(n, col + 1)) - s;
+    if(pos > col){
+      return col; //Nothing but ASCII up to and including column col
+    }
+    std::size_t c = pos;
+    while(pos < n){
+      unsigned len;
+      unsigned w = char_columns(s + pos, n - pos, len);
+      if(c == col && w > 0){
+	return pos;
+      }
+      if(c + w > col){
+	line.replace(pos, len, "  ", w);
+	return pos + (col - c);
+      }
+      c += w;
+      pos += len;
+    }
+    return n;
+  }
+
+  /// \brief Replace the characters in the \a cols columns starting at
+  /// \brief column \a col of the current line with the \a n bytes at \a s
+  ///
+  /// The line must reach column \a col.
+  void replace_cells(std::size_t col, std::size_t cols,
+		     const char* s, std::size_t n){
+    std::size_t start = cell_start(col);
+    std::size_t stop = cell_start(col + cols);
+    cur_line().replace(start, stop - start, s, n);
+  }
+
+  /// \brief Add spaces to the end of the current line until it reaches
+  /// \brief the cursor
+  void pad_to_cursor(){
+    if(char_idx == 0){
+      return;
+    }
+    std::size_t cols = line_columns();
+    if(char_idx > cols){
+      LineRef line = cur_line();
+      line.resize(line.size() + (char_idx - cols), ' ');
+    }
+  }
+
+  /// \brief Replace everything from the start of the current line
+  /// \brief through the cursor with spaces
+  ///
+  /// The line must go on past the cursor.
+  void blank_through_cursor(){
+    std::size_t stop = cell_start(char_idx + 1);
+    LineRef line = cur_line();
+    line.erase(0, stop);
+    line.insert(0, char_idx + 1, ' ');
+  }
+
+  /// Remove everything from the cursor to the end of the current line
+  void erase_from_cursor(){
+    std::size_t start = cell_start(char_idx);
+    LineRef line = cur_line();
+    if(start < line.size()){
+      line.erase(start, line.size() - start);
+    }
+  }
+
+  /// Return true if the scroll region is smaller than the screen
+  bool has_scroll_region() const{
+    return scroll_top != 0 || scroll_bottom + 1 != height;
+  }
+
+  /// \brief Move the screen so the cursor is on it, as a terminal
+  /// \brief scrolls when the cursor goes past its bottom
+  void follow_cursor(){
+    if(line_idx < screen_top){
+      screen_top = line_idx;
+    }else if(line_idx >= screen_top + height){
+      screen_top = line_idx + 1 - height;
+    }
+    if(line_idx > deepest_line){
+      deepest_line = line_idx;
+    }
+  }
+
+  /// \brief Note that the screen is being addressed, which a reader
+  /// \brief that started in the middle of the input can only do
+  /// \brief correctly once its screen has left its first line
+  void uses_screen(){
+    if(screen_top == 0){
+      needs_earlier = true;
+    }
+  }
+
+  /// Move the cursor to line \a row of the screen (0 at the top)
+  void go_to_row(std::size_t row){
+    lines.trim(line_idx);
+    line_idx = screen_top + std::min(row, height - 1);
+    while(line_idx >= lines.size()){
+      lines.push_back();
+    }
+    follow_cursor();
+  }
+
+  /// Perform a line-feed, adding blank lines and spaces if necessary
+  ///
+  /// At the bottom of a scroll region smaller than the screen, the
+  /// region scrolls up instead and its top line is lost.
+  void line_feed(){ 
+    if(has_scroll_region() && line_idx == screen_top + scroll_bottom){
+      lines.scroll_up(screen_top + scroll_top, line_idx, 1);
+    }else{
+      lines.trim(line_idx);
+      ++line_idx;
+      while(line_idx >= lines.size()) {
+	lines.push_back();
+      }
+      follow_cursor();
+    }
+    pad_to_cursor();
+    if(stream_out){
+      commit_lines();
+    }
+  }
+
+  /// \brief Return line \a i as it is written: its characters or, in
+  /// \brief HTML and ANSI format, its characters with their styles marked
+  ///
+  /// The result is only valid until the next call.
+  std::string_view output_line(std::size_t i){
+    std::string_view text(lines.data(i), lines.length(i));
+    if(format == typescript2txt::TEXT){
+      return text;
+    }
+    marked.clear();
+    const std::size_t n = lines.span_count(i);
+    uint32_t style = 0;
+    std::size_t from = 0;
+    for(std::size_t k = 0; k <= n; ++k){
+      LineStore::Span next = {uint32_t(text.size()), 0};
+      if(k < n){ next = lines.span(i, k); }
+      if(format == typescript2txt::HTML){
+	if(next.start > from){
+	  if(style != 0){ marked += styles.html_tag(style); }
+	  append_html(text.substr(from, next.start - from), marked);
+	  if(style != 0){ marked += "</span>"; }
+	}
+      }else{
+	marked.append(text, from, next.start - from);
+	styles.append_sgr(style, next.style, marked);
+      }
+      from = next.start;
+      style = next.style;
+    }
+    return marked;
+  }
+
+  /// Write out and forget the lines that have scrolled off the screen
+  ///
+  /// Only used in streaming mode.  A line is committed once it is
+  /// above the screen and no longer among the last \a height lines.
+  /// Lines inserted above the screen by reverse_line_feed therefore
+  /// stay until the cursor moves far enough down.
+  void commit_lines(){
+    std::size_t to_commit = 0;
+    while(to_commit < screen_top && lines.size() - to_commit > height){
+      stream_out->line(output_line(to_commit));
+      ++to_commit;
+    }
+    if(to_commit > 0){
+      lines.erase_front(to_commit);
+      line_idx -= to_commit;
+      screen_top -= to_commit;
+      deepest_line -= std::min(deepest_line, to_commit);
+    }
+  }
+
+  /// Return the number of lines write_to will write
+  ///
+  /// That is all of them unless the last line is blank (meaning that
+  /// it was created by a previous newline but nothing was written to
+  /// it).
+  std::size_t lines_to_write() const{
+    if(lines.length(lines.size() - 1) == 0){
+      return lines.size() - 1;
+    }
+    return lines.size();
+  }
+
+  /// Perform a reverse line-feed - go up one line
+  ///
+  /// At the top of a scroll region smaller than the screen, the region
+  /// scrolls down instead and its bottom line is lost.
+  void reverse_line_feed(){
+    if(has_scroll_region() && line_idx == screen_top + scroll_top){
+      insert_lines_here(1);
+    }else if(line_idx > 0){
+      lines.trim(line_idx);
+      --line_idx;
+      follow_cursor();
+    }else{
+      assert(line_idx == 0); //line_idx should never be negative
+      lines.push_front();
+      needs_earlier = true;
+    }
+    pad_to_cursor();
+  }
+
+  /// Perform a tab: position the cursor at the next tab stop
+  ///
+  /// Since tab-stops cannot be set right now, just puts the cursor at
+  /// the next multiple of 8
+  void tab(){
+    char_idx += (8-(char_idx%8))%8;
+  }
+
+  /// Perform a carriage return - put the current character index at the beginning of the line
+  void carriage_return(){
+    char_idx = 0;
+  }
+
+  /// Perform a back-space - move back over previous character
+  void back_space(){
+    if(char_idx > 0){
+      --char_idx;
+    }
+  }
+
+  /// Insert the given character at the current position, not moving
+  ///
+  /// Inserts \a c at the current position.  Does not change the
+  /// current position. If the current character is beyond the end of
+  /// the line, inserts enough spaces so that the character is written
+  /// at the correct position.
+  ///
+  /// \param c The character to insert
+  void insert_char(char c){
+    if(char_idx > cur_line().size()){
+      cur_line().resize(char_idx, ' ');
+    }
+    assert(char_idx <= cur_line().size());
+    if(char_idx == cur_line().size()){
+      cur_line().push_back(c);
+    }else if(char_idx < cur_line().size()){
+      cur_line().insert(char_idx, 1, c);
+    }else{
+      std::cerr << "SERIOUS WARNING: Impossible value for char_idx "
+		<< "in insert_char.  Ignoring.\n"
+		<< issue_report_boilerplate();
+    }
+  }
+
+  /// Set the current character to \a c and advance to the next
+  ///
+  /// Sets the character a the current position to \a c then advances
+  /// the current character to the next position.  If the current
+  /// character is beyond the end of the line, inserts enough spaces
+  /// so that the character is written at the correct position.
+  ///
+  /// \param c The new value of the character at the current position
+  void put_char(char c){
+    if(utf8 || cur_line().non_ascii()){
+      put_cell(&c, 1, 1);
+      return;
+    }
+    if(char_idx >= width){
+      if(std::ostream* out = warn("cursor beyond the right edge of the window")){
+	*out << "cursor beyond bounds of window in put_char.\n";
+      }
+      char_idx = width - 1;
+    }
+    if(char_idx > cur_line().size()){
+      cur_line().resize(char_idx, ' ');
+    }
+    assert(char_idx <= cur_line().size());
+    if(char_idx == cur_line().size()){
+      cur_line().push_back(c);
+      ++char_idx;
+      if(char_idx >= width){
+	carriage_return(); line_feed();
+      }
+    }else if(char_idx < cur_line().size()){
+      cur_line().write(char_idx, &c, 1);
+      ++char_idx;
+      if(char_idx >= width){
+	carriage_return(); line_feed();
+      }
+    }else{
+      std::cerr << "SERIOUS WARNING: Impossible value for char_idx "
+		<< "in put_char.  Ignoring.\n"
+		<< issue_report_boilerplate();
+    }
+  }
+
+  /// Write the \a n characters starting at \a s as if by put_char
+  ///
+  /// Equivalent to calling put_char on each character in turn, but
+  /// copies everything that fits before the next wrap in one piece.
+  ///
+  /// \param s the characters to write.  None of them may be control
+  ///          characters.
+  ///
+  /// \param n the number of characters to write
+  void put_chars(const char* s, std::size_t n){
+    while(n > 0){
+      if(char_idx >= width){
+	//Let put_char deal with (and warn about) the bad cursor position
+	put_char(*s); ++s; --n;
+	continue;
+      }
+      std::size_t to_write = std::min(n, width - char_idx);
+      LineRef line = cur_line();
+      if(line.non_ascii()){
+	put_ascii_over_utf8(s, to_write);
+      }else{
+	if(char_idx > line.size()){
+	  line.resize(char_idx, ' ');
+	}
+	line.write(char_idx, s, to_write);
+      }
+      char_idx += to_write; s += to_write; n -= to_write;
+      if(char_idx >= width){
+	carriage_return(); line_feed();
+      }
+    }
+  }
+
+  /// \brief Write the \a n ASCII characters at \a s at the cursor of a
+  /// \brief line that holds other UTF-8 characters, without wrapping
+  ///
+  /// Kept out of put_chars so the common case there stays small.
+  __attribute__((noinline))
+  void put_ascii_over_utf8(const char* s, std::size_t n){
+    pad_to_cursor();
+    replace_cells(char_idx, n, s, n);
+  }
+
+  /// \brief Write the character whose UTF-8 encoding is the \a n bytes
+  /// \brief at \a s and which takes up \a cols columns, then advance
+  /// \brief past it
+  ///
+  /// The UTF-8 mode version of put_char.  A wide character that does
+  /// not fit before the right edge goes to the next line, and one that
+  /// takes no columns joins the character before the cursor.
+  void put_cell(const char* s, std::size_t n, unsigned cols){
+    if(char_idx >= width){
+      if(std::ostream* out = warn("cursor beyond the right edge of the window")){
+	*out << "cursor beyond bounds of window in put_char.\n";
+      }
+      char_idx = width - 1;
+    }
+    if(char_idx + cols > width){
+      carriage_return(); line_feed();
+    }
+    pad_to_cursor();
+    if(cols == 0){
+      cur_line().replace(cell_start(char_idx), 0, s, n);
+      cur_line().mark_non_ascii();
+      return;
+    }
+    replace_cells(char_idx, cols, s, n);
+    if(n > 1){
+      cur_line().mark_non_ascii();
+    }
+    char_idx += cols;
+    if(char_idx >= width){
+      carriage_return(); line_feed();
+    }
+  }
+
+  /// \brief Read the versions of the current line that follow a
+  /// \brief carriage return and are overwritten by later ones, writing
+  /// \brief only what can still be seen
+  ///
+  /// Progress bars redraw their line many times, starting each version
+  /// with a carriage return, and only the last version (plus the tail
+  /// of any longer earlier one) survives.  Starting at \a p, just after
+  /// a carriage return in the SAW_NOTHING state, this takes each
+  /// segment of printable characters, optionally ended by ESC [ K,
+  /// that is itself ended by a carriage return and is too short to
+  /// wrap.  The first segment that does not qualify, and everything
+  /// after it, is left for the caller to read as usual.
+  ///
+  /// The segments taken are applied last to first: each writes only
+  /// the columns beyond the longest later segment, and one ending in
+  /// ESC [ K cuts the line there and makes all earlier ones invisible.
+  /// The result is the same as reading them one byte at a time.  In
+  /// UTF-8 mode only ASCII segments over a line of ASCII are taken, so
+  /// that columns and bytes are the same.
+  ///
+  /// \param p the byte after a carriage return; the cursor must be at
+  ///          column 0
+  ///
+  /// \param end one past the last byte available
+  ///
+  /// \return the byte after the carriage return ending the last
+  ///         segment taken, or \a p if none was taken
+  const char* overwrite_segments(const char* p, const char* end){
+    const char* run_end = p;
+    for(;;){
+      const char* text_end = find_run_end(run_end, end);
+      const char* cr = text_end;
+      if(end - cr >= 4 && cr[0] == '\x1B' && cr[1] == '[' && cr[2] == 'K'){
+	cr += 3;
+      }
+      if(cr == end || *cr != '\r' ||
+	 std::size_t(text_end - run_end) >= width){
+	break;
+      }
+      run_end = cr + 1;
+    }
+    if(run_end == p || cur_line().non_ascii()){
+      return p; //Nothing to do, or columns are not bytes
+    }
+
+    LineRef line = cur_line();
+    std::size_t covered = 0; //Columns already decided by later segments
+    const char* seg_end = run_end - 1; //The carriage return ending it
+    for(;;){
+      const char* seg_begin = seg_end;
+      while(seg_begin > p && seg_begin[-1] != '\r'){
+	--seg_begin;
+      }
+      const char* text_end = seg_end;
+      bool erases = seg_end - seg_begin >= 3 && seg_end[-3] == '\x1B';
+      if(erases){
+	text_end -= 3;
+      }
+      std::size_t len = text_end - seg_begin;
+      if(len > covered){
+	line.write(covered, seg_begin + covered, len - covered);
+	covered = len;
+      }
+      if(erases){
+	if(line.size() > covered){
+	  line.erase(covered, line.size() - covered);
+	}
+	break;
+      }
+      if(seg_begin == p){
+	break;
+      }
+      seg_end = seg_begin - 1;
+    }
+    return run_end;
+  }
+
+  /// \brief Read the UTF-8 sequence starting at \a p, or the rest of
+  /// \brief the one pending from the last block, and write its character
+  ///
+  /// Only used in UTF-8 mode in the SAW_NOTHING state.  A sequence that
+  /// is not valid UTF-8 is written as the replacement character U+FFFD
+  /// (with a warning), and the byte that showed it to be invalid is
+  /// left to be read as the start of something else.
+  ///
+  /// \param p the next byte to read: the lead byte of a sequence unless
+  ///          one is pending
+  ///
+  /// \param end one past the last byte available
+  ///
+  /// \return the first byte not used.  If that is \a end the sequence
+  ///         may still be pending.
+  const char* read_utf8(const char* p, const char* end){
+    if(utf8_have == 0){
+      utf8_pending[utf8_have++] = *p++;
+    }
+    unsigned need = utf8_length(utf8_pending[0]);
+    while(need > 1 && utf8_have < need){
+      if(p == end){
+	return p;
+      }
+      unsigned char b = *p;
+      if(utf8_have == 1 ? !utf8_second_ok(utf8_pending[0], b) :
+	 (b & 0xC0) != 0x80){
+	need = 0;
+	break;
+      }
+      utf8_pending[utf8_have++] = b;
+      ++p;
+    }
+    utf8_have = 0;
+    const char* bytes = reinterpret_cast<const char*>(utf8_pending);
+    if(need <= 1){
+      if(std::ostream* out = warn("invalid UTF-8 written as U+FFFD")){
+	*out << "typescript contains a byte sequence that is not valid "
+	     << "UTF-8.  It is written as the replacement character.\n";
+      }
+      put_cell("\xEF\xBF\xBD", 3, 1);
+      return p;
+    }
+    char32_t cp;
+    decode_utf8(bytes, need, cp);
+    if(cp < 0xA0){
+      //A C1 control: U+009B is CSI as the byte 0x9B is outside UTF-8
+      //mode.  The others are not printed.
+      if(cp == 0x9B){
+	set_state(SAW_CSI);
+      }
+      return p;
+    }
+    put_cell(bytes, need, display_width(cp));
+    return p;
+  }
+
+  /// Set the state to new_state and clear parameter array
+  ///
+  /// Sets the state of the reader to new_state and (since the
+  /// parameter array is in one sense part of the command reading
+  /// state) clear that array.
+  ///
+  /// \param new_state the new state of the reader after set_state
+  void set_state(RState new_state){
+    state = new_state;
+    params.clear();
+  }
+
+
+  /// Return the position in the input of the byte being processed
+  uint64_t offset() const{
+    return bytes_before + (pos - block_begin);
+  }
+
+  /// \brief Count a warning about the current byte; return the stream
+  /// \brief to describe it on or NULL if it need not be described
+  ///
+  /// \param context a string literal naming the kind of problem
+  ///
+  /// \param code the character the warning is about, if any
+  ///
+  /// \return see Diagnostics::report
+  std::ostream* warn(const char* context, 
+		     unsigned code = Diagnostics::no_code){
+    return diag.report(context, code, offset());
+  }
+
+  /// Warn about \a c whose meaning is unknown in the given context
+  ///
+  /// \param context a string describing the context in which \c is unknown
+  ///
+  /// \param c the character whose meaning is unknown in the given context
+  void unknown_code(const char* context, unsigned char c){
+    if(std::ostream* out = warn(context, c)){
+      *out << "the meaning of the character '";
+      write_code(*out, c);
+      *out << "' (" << ((unsigned int)c) << " decimal) "
+	   << "is unknown in the context of a " << context << ".\n";
+    }
+  }
+
+  /// Warn that the CSI command \a code was given more parameters than
+  /// it uses
+  ///
+  /// \param name the name of the command for the warning message
+  ///
+  /// \param code the final character of the command
+  void too_many_arguments(const char* name, char code){
+    if(std::ostream* out = warn("too many arguments to a CSI command", code)){
+      *out << "too many arguments given to " << name
+	   << " CSI command ESC [ ... " << code << "\n"
+	   << "Ignoring extra parameters\n";
+    }
+  }
+
+  /// Performs the insert blank CSI command ESC [ ... @
+  ///
+  /// If not at the end of a line, inserts the number of blanks
+  /// required by \a param.  The blanks are inserted together, moving
+  /// the rest of the line only once.  Characters pushed past the right
+  /// edge of the screen are lost, as on a terminal, so repeated
+  /// inserts cannot make a line longer than the screen is wide.
+  ///
+  /// At the end of a line, does nothing.
+  ///
+  /// \param params is an array with the parameters passed to the
+  ///               command.  If no parameters are given, inserts one
+  ///               blank.  Otherwise, inserts as many blanks as the
+  ///               value of the first parameter.  Prints a warning if
+  ///               there is more than one parameter.
+  void insert_blank(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("insert blank", '@');
+    }
+    if(char_idx >= line_columns()){
+      return;
+    }
+    std::size_t start = cell_start(char_idx);
+    std::size_t count = std::min<std::size_t>(params.first_or(1), 
+					      width - std::min(width, char_idx));
+    cur_line().insert(start, count, ' ');
+    std::size_t edge = cell_start(width);
+    if(edge < cur_line().size()){
+      cur_line().resize(edge, ' ');
+    }
+  }
+
+  /// Performs the cursor up CSI command ESC [ ... A
+  ///
+  /// Moves the cursor up the number of lines required by \a param.
+  /// Does not make new lines above the first line.
+  ///
+  /// \param params is an array with the parameters passed to the
+  ///               command.  If no parameters are given, goes up one
+  ///               line blank.  Otherwise, goes up as many lines as
+  ///               the value of the first parameter.  Prints a
+  ///               warning if there is more than one parameter.  Does
+  ///               not go above the top of the screen
+  void cursor_up(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("cursor up", 'A');
+    }
+    unsigned n = params.first_or(1);
+    lines.trim(line_idx);
+    if(line_idx >= screen_top + n){
+      line_idx -= n;
+    }else{
+      if(screen_top == 0){
+	needs_earlier = true;
+      }
+      line_idx = screen_top;
+    }
+  }
+
+  /// Performs the cursor down CSI command ESC [ ... B
+  ///
+  /// Moves the cursor down the number of lines required by \a param.
+  /// Does not make new lines below the last line.
+  ///
+  /// \param params is an array with the parameters passed to the
+  ///               command.  If no parameters are given, goes down one
+  ///               line.  Otherwise, goes down as many lines as
+  ///               the value of the first parameter.  Prints a
+  ///               warning if there is more than one parameter.  Does
+  ///               not go above the first line
+  void cursor_down(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("cursor down", 'B');
+    }
+    unsigned n = params.first_or(1);
+    lines.trim(line_idx);
+    if(line_idx + n < lines.size()){
+      line_idx += n;
+    }else{
+      line_idx = lines.size() - 1;
+    }
+    follow_cursor();
+  }
+
+  /// Performs the cursor right CSI command ESC [ ... C
+  ///
+  /// Moves the cursor right the number of columns required by \a
+  /// param.
+  /// 
+  ///
+  /// \param params is an array with the parameters passed to the
+  ///               command.  If no parameters are given, goes right one
+  ///               column.  Otherwise, goes right as many columns as
+  ///               the value of the first parameter.  Prints a
+  ///               warning if there is more than one parameter.
+  void cursor_right(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("cursor right", 'C');
+    }
+    char_idx += params.first_or(1);
+  }
+
+  /// Performs the delete characters CSI command ESC [ ... P
+  ///
+  /// Removes the number of characters indicated by \a params from the
+  /// line to the right of the current cursor location.  Shifts all
+  /// characters after the one to delete to the left to fill in the gap.
+  /// If the cursor is past the end of the line, does nothing.
+  ///
+  /// \param params is an array with the parameters passed to the
+  ///               command.  If no parameters are given, deletes one
+  ///               character.  Otherwise, deletes as many characters
+  ///               as the value of the first parameter.  Prints a
+  ///               warning if there is more than one parameter.
+  void delete_characters(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("delete characters", 'P');
+    }
+    unsigned n = params.first_or(1);
+    if(n > 0){
+      std::size_t columns = line_columns();
+      if(char_idx < columns){
+	std::size_t chars_to_delete = std::min<std::size_t>(columns - char_idx, n);
+	std::size_t start = cell_start(char_idx);
+	std::size_t stop = cell_start(char_idx + chars_to_delete);
+	cur_line().erase(start, stop - start);
+      }
+    }
+  }
+
+  /// Performs the erase line CSI command ESC [ ... K
+  /// 
+  /// If the parameters array is empty removes all characters in
+  /// cur_line() at or after char_idx. 
+  ///
+  /// If the parameters array holds at least one value, then the first
+  /// value must be 1 or 2.  If the first value is neither 1 or 2,
+  /// then prints a warning and does nothing.
+  /// 
+  /// If the first value is 1, the behavior depends on whether
+  /// char_idx is past the end of the line.  If there are characters
+  /// past char_idx in the line, fills all characters from the
+  /// beginning of the line to char_idx (inclusive) with blanks.
+  /// Otherwise the behavior is identical to if the param value had
+  /// been 2.
+  ///
+  /// If the first value is 2, deletes all characters in the array,
+  /// but leaves char_idx the same.
+  ///
+  /// If there is more than one argument, prints a warning
+  ///
+  /// \param params The parameters passed to the CSI K command - see
+  ///               the main text for a description of behavior
+  void erase_line(const CSIParams& params){
+    if(params.size() == 0){
+      erase_from_cursor();
+    }else{
+      if(params.size() > 1){
+	too_many_arguments("erase line", 'K');
+      }
+      unsigned p = params.at(0);
+      if(p != 1 && p != 2){
+	if(std::ostream* out = warn("unknown argument to erase line "
+				    "CSI command ESC [ ... K")){
+	  *out << "argument " << p << " passed to erase line "
+	       << "CSI command ESC [ ... K\n"
+	       << "The meaning of this argument is unknown.  "
+	       << "Doing nothing.\n";
+	}
+	return;
+      }
+      if(p == 2 || (char_idx + 1) >= line_columns()){
+	//Delete whole line:
+	//Param was 2 or we are at or past the last character in the line
+	cur_line().clear();
+	return;
+      }else{
+	//Delete chars before and at char_idx when there is at least
+	//one character that won't be deleted
+	assert(p == 1);
+	blank_through_cursor();
+	return;
+      }
+    }
+  }
+
+  /// \brief Insert \a n blank lines at the cursor line, moving the
+  /// \brief lines below it down within the scroll region
+  ///
+  /// Lines pushed past the bottom of the scroll region are lost.
+  /// Blank screen lines below the last line are not added unless
+  /// text moves into them.
+  void insert_lines_here(std::size_t n){
+    std::size_t bottom = screen_top + scroll_bottom;
+    if(line_idx > bottom){
+      return;
+    }
+    std::size_t last = std::min(bottom, lines.size() - 1 + n);
+    while(lines.size() <= last){
+      lines.push_back();
+    }
+    lines.scroll_down(line_idx, last, n);
+  }
+
+  /// Performs the cursor position CSI command ESC [ row ; col H
+  /// (also ESC [ row ; col f)
+  ///
+  /// Moves the cursor to the given row and column of the screen.
+  /// Rows and columns count from 1, which is also the default for
+  /// missing or 0 values.  Values beyond the screen are taken to mean
+  /// its last row or column.
+  ///
+  /// \param params the row and column
+  void cursor_position(const CSIParams& params){
+    uses_screen();
+    std::size_t row = params.first_or(1);
+    std::size_t col = params.size() > 1 ? params.at(1) : 1;
+    go_to_row(row > 0 ? row - 1 : 0);
+    char_idx = std::min(col > 0 ? col - 1 : 0, width - 1);
+  }
+
+  /// Performs the line position absolute CSI command ESC [ ... d
+  ///
+  /// Moves the cursor to the given row of the screen, counting from
+  /// 1, without changing the column
+  ///
+  /// \param params the row (default 1)
+  void line_position(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("line position absolute", 'd');
+    }
+    uses_screen();
+    std::size_t row = params.first_or(1);
+    go_to_row(row > 0 ? row - 1 : 0);
+  }
+
+  /// Performs the cursor character absolute CSI command ESC [ ... G
+  /// (also ESC [ ... `)
+  ///
+  /// Moves the cursor to the given column, counting from 1, on the
+  /// current line
+  ///
+  /// \param params the column (default 1)
+  void column_position(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("cursor character absolute", 'G');
+    }
+    std::size_t col = params.first_or(1);
+    char_idx = std::min(col > 0 ? col - 1 : 0, width - 1);
+  }
+
+  /// Performs the erase display CSI command ESC [ ... J
+  ///
+  /// With no parameter or 0, erases from the cursor to the end of the
+  /// screen; with 1, from the start of the screen through the cursor.
+  ///
+  /// With 2 (and with 0 when the cursor is at the top left corner,
+  /// which is how the clear command erases the screen) the text on the
+  /// screen is kept in the scrollback and the screen starts again
+  /// below it, as in terminals that keep cleared screens in their
+  /// history.  Throwing it away would lose most of a transcript of
+  /// full screen programs, which clear the screen often.
+  ///
+  /// 3 (erase the scrollback) is ignored: the scrollback is the
+  /// transcript.
+  ///
+  /// \param params the part of the screen to erase
+  void erase_display(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("erase display", 'J');
+    }
+    unsigned p = params.first_or(0);
+    if(p == 3){
+      return;
+    }
+    if(p > 3){
+      if(std::ostream* out = warn("unknown argument to erase display "
+				  "CSI command ESC [ ... J")){
+	*out << "argument " << p << " passed to erase display "
+	     << "CSI command ESC [ ... J\n"
+	     << "The meaning of this argument is unknown.  "
+	     << "Doing nothing.\n";
+      }
+      return;
+    }
+    uses_screen();
+    std::size_t screen_end = std::min(lines.size(), screen_top + height);
+    if(p == 2 || (p == 0 && line_idx == screen_top && char_idx == 0)){
+      std::size_t last_used = screen_end;
+      while(last_used > screen_top && lines.length(last_used - 1) == 0){
+	--last_used;
+      }
+      if(last_used == screen_top){
+	return; //Nothing on the screen
+      }
+      std::size_t row = line_idx - screen_top;
+      screen_top = last_used;
+      if(screen_top == lines.size()){
+	lines.push_back();
+      }
+      go_to_row(row);
+      if(stream_out){
+	commit_lines();
+      }
+    }else if(p == 0){
+      erase_from_cursor();
+      for(std::size_t i = line_idx + 1; i < screen_end; ++i){
+	lines.resize(i, 0, ' ');
+      }
+    }else{
+      for(std::size_t i = screen_top; i < line_idx; ++i){
+	lines.resize(i, 0, ' ');
+      }
+      if(char_idx + 1 >= line_columns()){
+	cur_line().clear();
+      }else{
+	blank_through_cursor();
+      }
+    }
+  }
+
+  /// Performs the insert lines CSI command ESC [ ... L
+  ///
+  /// If the cursor is in the scroll region, inserts the given number
+  /// of blank lines (default 1) at the cursor line, moving the lines
+  /// below down.  Lines moved past the bottom of the scroll region are
+  /// lost.  The cursor moves to the start of the line.
+  ///
+  /// \param params the number of lines to insert
+  void insert_lines(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("insert lines", 'L');
+    }
+    uses_screen();
+    if(line_idx < screen_top + scroll_top){
+      return;
+    }
+    insert_lines_here(std::max(1u, params.first_or(1)));
+    char_idx = 0;
+  }
+
+  /// Performs the delete lines CSI command ESC [ ... M
+  ///
+  /// If the cursor is in the scroll region, deletes the given number
+  /// of lines (default 1) starting with the cursor line, moving the
+  /// lines below up.  Blank lines come in at the bottom of the scroll
+  /// region.  The cursor moves to the start of the line.
+  ///
+  /// \param params the number of lines to delete
+  void delete_lines(const CSIParams& params){
+    if(params.size() > 1){
+      too_many_arguments("delete lines", 'M');
+    }
+    uses_screen();
+    std::size_t bottom = screen_top + scroll_bottom;
+    if(line_idx < screen_top + scroll_top || line_idx > bottom){
+      return;
+    }
+    std::size_t n = std::max(1u, params.first_or(1));
+    char_idx = 0;
+    if(bottom + 1 < lines.size()){
+      lines.scroll_up(line_idx, bottom, n);
+      return;
+    }
+    //The region reaches past the last line, where the screen is blank
+    //anyway: drop the deleted lines instead of adding blank ones
+    std::size_t last = lines.size() - 1;
+    lines.scroll_up(line_idx, last, n);
+    lines.erase_back(std::min(n, last + 1 - line_idx));
+    while(line_idx >= lines.size()){
+      lines.push_back();
+    }
+  }
+
+  /// Performs the set scrolling region CSI command ESC [ top ; bottom r
+  ///
+  /// Makes line feeds at the bottom row (and reverse line feeds at the
+  /// top row) scroll only the rows from top to bottom, counting from
+  /// 1.  The defaults are the whole screen.  Invalid regions are
+  /// ignored.  The cursor moves to the top left corner.
+  ///
+  /// \param params the top and bottom rows
+  void set_scroll_region(const CSIParams& params){
+    if(params.size() > 2){
+      too_many_arguments("set scrolling region", 'r');
+    }
+    uses_screen();
+    std::size_t top = params.first_or(1);
+    std::size_t bottom = params.size() > 1 && params.at(1) != 0 ? 
+      params.at(1) : height;
+    top = top > 0 ? top - 1 : 0;
+    bottom = std::min(bottom, height) - 1;
+    if(top >= bottom){
+      return;
+    }
+    scroll_top = top;
+    scroll_bottom = bottom;
+    go_to_row(0);
+    char_idx = 0;
+  }
+
+  /// \brief Performs the select graphic rendition CSI command
+  /// \brief ESC [ attributes m
+  ///
+  /// Sets the style of the characters written from now on.  Only called
+  /// when the lines are written as HTML or ANSI; plain text ignores
+  /// attributes, and this is kept out of read_from for its sake.
+  /// Handles the attributes of ECMA-48 and the 256 colour and direct
+  /// colour extensions (38;5;n and 38;2;r;g;b) but not their forms
+  /// with colons.  Other attributes are ignored, as is the whole
+  /// sequence after a private marker (such as xterm's CSI > 4 ; 1 m).
+  ///
+  /// \param params the attributes; none is the same as 0, the default
+  __attribute__((noinline))
+  void select_graphic_rendition(const CSIParams& params){
+    if(params.is_private()){
+      return;
+    }
+    Style s = pen;
+    if(params.size() == 0){
+      s = Style();
+    }
+    const std::size_t n = params.overflow() ? CSIParams::max_params : 
+      params.size();
+    for(std::size_t k = 0; k < n; ++k){
+      unsigned p = params.at(k);
+      switch(p){
+      case 0: s = Style(); break;
+      case 1: s.flags |= Style::BOLD; break;
+      case 2: s.flags |= Style::DIM; break;
+      case 3: s.flags |= Style::ITALIC; break;
+      case 4: case 21: s.flags |= Style::UNDERLINE; break;
+      case 5: case 6: s.flags |= Style::BLINK; break;
+      case 7: s.flags |= Style::REVERSE; break;
+      case 8: s.flags |= Style::INVISIBLE; break;
+      case 9: s.flags |= Style::STRIKE; break;
+      case 22: s.flags &= ~(Style::BOLD | Style::DIM); break;
+      case 23: s.flags &= ~Style::ITALIC; break;
+      case 24: s.flags &= ~Style::UNDERLINE; break;
+      case 25: s.flags &= ~Style::BLINK; break;
+      case 27: s.flags &= ~Style::REVERSE; break;
+      case 28: s.flags &= ~Style::INVISIBLE; break;
+      case 29: s.flags &= ~Style::STRIKE; break;
+      case 39: s.fg = 0; break;
+      case 49: s.bg = 0; break;
+      case 38: case 48:{
+	uint32_t& color = p == 38 ? s.fg : s.bg;
+	if(k + 2 < n && params.at(k + 1) == 5){
+	  color = 1 + std::min(params.at(k + 2), 255u);
+	  k += 2;
+	}else if(k + 4 < n && params.at(k + 1) == 2){
+	  color = Style::rgb + (std::min(params.at(k + 2), 255u) << 16 |
+				std::min(params.at(k + 3), 255u) << 8 |
+				std::min(params.at(k + 4), 255u));
+	  k += 4;
+	}else{
+	  k = n; //Malformed: the rest cannot be understood
+	}
+	break;
+      }
+      default:
+	if(p >= 30 && p <= 37){
+	  s.fg = 1 + p - 30;
+	}else if(p >= 40 && p <= 47){
+	  s.bg = 1 + p - 40;
+	}else if(p >= 90 && p <= 97){
+	  s.fg = 1 + 8 + p - 90;
+	}else if(p >= 100 && p <= 107){
+	  s.bg = 1 + 8 + p - 100;
+	}
+      }
+    }
+    if(s != pen){
+      pen = s;
+      lines.set_pen(styles.number(s));
+    }
+  }
+
+  /// \brief Return a string containing instructions for reporting an issue
+  /// \brief with the program
+  ///
+  /// \return a string containing instructions for reporting an issue
+  ///         with the program
+  char const * issue_report_boilerplate(){
+    return "Please submit an issue report to "
+      "https://github.com/RadixSeven/typescript2txt/issues "
+      "and include the file you were processing by following the instructions "
+      "in https://github.com/ned14/Easyshop/issues/1\n";
+  }
+
+
+  /// Do nothing
+  ///
+  /// This function is called to document that a CSI command is
+  /// intentionally not implemented because it is not appropriate to
+  /// generating plain text files.
+  void ignore_CSI(){ }
+
+
+  //###################################################
+  //###################################################
+  //###    Unimplemented Codes That Generate Warnings
+  //###################################################
+  //###################################################
+
+  /// Print a warning that the given CSI command is unimplemented
+  ///
+  /// Unlike the regular escape codes which all have different
+  /// structrues, I can use a generic warning routine because of the
+  /// simple structure of the CSI codes: list of parameters followed
+  /// by an action character.
+  ///
+  /// This warning lets a programmer just implement the codes needed
+  /// to parse his files and ignore the rest.
+  ///
+  /// This is called for CSI codes that may impact plain text output,
+  /// so someone may want to implement them in the future.
+  ///
+  /// \param code The single character command code that identifies
+  ///             the CSI command.  This would be @ for insert blanks,
+  ///             A for cursor up, etc.
+  ///
+  /// \param descr A longer description of the code
+  ///
+  /// \param params The parameters that would have been passed to the code
+  void unimplemented_CSI(char code, const char* descr, 
+			 const CSIParams& params){
+    std::ostream* out = warn("unimplemented CSI command", code);
+    if(out == NULL){
+      return;
+    }
+    *out << "this typescript contains an unimplemented CSI "
+	 << "code \"ESC [ ... " << code << "\".  "
+	 << "The code has description: \"" << descr << "\" and was "
+	 << "passed ";
+    if(params.size() == 0){
+      *out << "no parameters.  ";
+    }else{
+      *out << "The parameters: " << params.at(0);
+      for(std::size_t i=1; i < params.size(); ++i){
+	if(i == CSIParams::max_params){
+	  *out << ", ...";
+	  break;
+	}
+	*out << ", " << params.at(i);
+      }
+      *out << ".  ";
+    }
+    *out << "Ignoring.\n";
+  }
+
+
+  /// Execute character set change to \a num - just prints warning right now
+  ///
+  /// \param num the number of the character set to change to
+  void character_set(int num){
+    if(std::ostream* out = warn("character set change (^N or ^O) ignored",
+				num == 0 ? 0x0F : 0x0E)){
+      *out << "typescript file contains command to change to the "
+	   << "G" << num << " character set.  This command is ignored by "
+	   << "this translator.\n";
+    }
+  }
+
+  /// Set a horizontal tab stop at the current cursor position
+  /// 
+  /// Right now, does nothing but print a warning
+  void set_htab_stop(){
+    if(std::ostream* out = warn("tab stop setting (ESC H) ignored")){
+      *out << "typescript file contains tab-stop-changing "
+	   << "commands that are ignored by this translator.\n";
+    }
+  }
+
+  /// Save the cursor state for later restoration
+  ///
+  /// Right now, does nothing but print a warning
+  void save_cursor_state(){
+    if(std::ostream* out = warn("cursor state saving (ESC 7) ignored")){
+      *out << "typescript file contains cursor-state-saving "
+	   << "commands that are ignored by this translator.\n";
+    }
+  }
+
+  /// Restore the cursor state for later restoration
+  ///
+  /// Right now, does nothing but print a warning
+  void restore_cursor_state(){
+    if(std::ostream* out = warn("cursor state restoring (ESC 8) ignored")){
+      *out << "typescript file contains cursor-state-restoring "
+	   << "commands that are ignored by this translator.\n";
+    }
+  }
+
+  /// Select character set based on the given \a code which must be @,G, or 8
+  ///
+  /// Turns UTF-8 mode on or off.  Text written before UTF-8 mode was
+  /// turned on keeps taking a column per byte.
+  ///
+  /// \param code @ selects the default (ISO 646/ISO 8859-1: one byte is
+  ///             one character), G and 8 select UTF-8
+  void select_character_set(const char code){
+    assert(code == '@' || code == 'G' || code == '8');
+    if(code == '@' || code == 'G' || code == '8'){
+      set_utf8(code != '@');
+    }else{
+      std::cerr << "SERIOUS WARNING: Illegal code passed to "
+		<< "select_character_set.  Ignoring.\n"
+		<< issue_report_boilerplate();
+      return;
+    }
+  }
+
+  /// Define the character set mapping for G0 or G1 
+  ///
+  /// Right now does nothing but print a warning.
+  ///
+  /// Assumes code is one of B,0,U, or X and g_number is 0 or 1
+  ///
+  /// \param g_number if 0 defines, G0, if 1 defines G1
+  ///
+  /// \param code The character from the escape code indicating which
+  ///             mapping.  From the man page: B = Select default (ISO
+  ///             8859-1 mapping), 0 = Select VT100 graphics mapping,
+  ///             U = Select null mapping - straight to character ROM,
+  ///             K = Select user mapping - the map that is loaded by
+  ///             the utility mapscrn(8).
+  void  define_g_character_set(const unsigned g_number, const char code){
+    assert(code == 'B' || code == '0' || code == 'U' || code == 'K');
+    assert(g_number == 0 || g_number == 1);
+    const char* mapping;
+    switch(code){
+    case 'B': mapping = "ISO 8859-1"; break;
+    case '0': mapping = "VT100 graphics"; break;
+    case 'U': mapping = "the null mapping (straight to character ROM)"; break;
+    case 'K': mapping = "the user mapping (loaded by mapscrn(8))"; break;
+    default:
+      std::cerr << "SERIOUS WARNING: Illegal code passed to "
+		<< "define_g_character_set.  Ignoring."
+		<< issue_report_boilerplate();
+      return;
+    }
+    char g_char = (g_number == 0?'(':')');
+    std::ostream* out = warn(g_number == 0 ? 
+			     "G0 character set definition (ESC () ignored" :
+			     "G1 character set definition (ESC )) ignored", 
+			     code);
+    if(out != NULL){
+      *out << "typescript contains command to define the G" 
+	   << g_number << " character set as " << mapping << "\n"
+	   << "This command -- ESC " << g_char
+	   << ' ' << code << " -- is currently ignored by this translator.\n";
+    }
+  }
+
+  ///Set the palette entry at \a index to the color described by \a rgb
+  ///
+  /// Right now, just prints a warning
+  ///
+  /// \param index The index of of the palette entry to set 0-15 inclusive
+  ///
+  /// \param rgb The 24 bit number whose lower 3 bytes describe the
+  ///            red, green, and blue intensities in that order
+  ///            (xxxxxxxxRRRRRRRRGGGGGGGGBBBBBBBB)
+  void set_palette(int index, int rgb){
+    if(rgb & 0xFF000000){
+      std::cerr << "SERIOUS WARNING: Illegal RGB value "
+		<< std::hex << ((unsigned)rgb) << " passed to "
+		<< "set_palette.  Ignoring."
+		<< issue_report_boilerplate();
+      return;
+    }
+    if(index < 0 || index > 15){
+      std::cerr << "SERIOUS WARNING: Illegal index value "
+		<< index << " passed to "
+		<< "set_palette.  Ignoring."
+		<< issue_report_boilerplate();
+      return;
+    }
+    int r = (rgb >> 16) & 0xFF;
+    int g = (rgb >> 8)  & 0xFF;
+    int b = rgb         & 0xFF;
+    if(std::ostream* out = warn("palette setting (ESC ] P) ignored")){
+      *out << "typescript contains command to set palette " 
+	   << "entry " << index << " to rgb=("<< r << ',' << g << ','
+	   << b << ")  This command is ignored by this translator.\n";
+    }
+  }
+
+  /// Read one hex digit \a c of the palette setting command ESC ] P
+  ///
+  /// The command is followed by 7 hex digits: the palette index and
+  /// the red, green and blue values.  After the last one, the palette
+  /// entry is set and the reader goes back to SAW_NOTHING.
+  ///
+  /// params[0] holds the number of hex digits read, params[1] the
+  /// index to set and params[2] the color to set it to (24 bit integer)
+  ///
+  /// \param c an upper case hex digit
+  void palette_digit(char c){
+    if(params.size() == 0){
+      params.push_back(0); params.push_back(0); params.push_back(0);
+    }
+    unsigned value = (c <= '9') ? c - '0' : c - 'A' + 10;
+    ++params.at(0);
+    if(params.at(0) == 1){
+      params.at(1) = value;
+    }else{
+      params.at(2) = (params.at(2) << 4) + value;
+      if(params.at(0) == 7){
+	set_palette(params.at(1), params.at(2));
+	set_state(SAW_NOTHING);
+      }
+    }
+  }
+
+  /// Reset the palette 
+  ///
+  /// Right now, does nothing but print a warning
+  void reset_palette(){
+    if(std::ostream* out = warn("palette reset (ESC ] R) ignored")){
+      *out << "typescript contains command to reset the palette.  " 
+	   << "This command is ignored by this translator.\n";
+    }
+  }
+
+  /// \brief Read the header line that script writes at the start of a
+  /// \brief typescript, if [begin, end) starts with one
+  ///
+  /// The header is written to the file but never appeared on the
+  /// terminal, so it becomes a line of its own however long it is,
+  /// rather than being wrapped at the right edge.  The size of the
+  /// terminal is taken from it if size_from_header asked for that.
+  ///
+  /// \return the byte after the header, or \a begin if there is none
+  const char* read_script_header(const char* begin, const char* end);
+public:
+  /// Create an empty reader that has read nothing
+  Reader():line_idx(0),char_idx(0),width(80),stream_out(NULL),height(24),
+	   screen_top(0),scroll_top(0),scroll_bottom(23),deepest_line(0),
+	   bytes_before(0),block_begin(NULL),pos(NULL),needs_earlier(false),
+	   utf8(false),utf8_have(0),state(SAW_NOTHING),table(&transitions),
+	   find_run_end(find_control_char),header_width(false),
+	   header_height(false),format(typescript2txt::TEXT){
+    lines.set_line_reserve(width);
+    lines.push_back();
+  }
+
+  /// Return the collector of the warnings about the typescript
+  Diagnostics& diagnostics(){ return diag; }
+
+  /// \brief Write lines to \a out as soon as they scroll off the screen
+  ///
+  /// In streaming mode the reader keeps only the lines that are on the
+  /// screen, so memory use depends on the screen height rather than
+  /// on the length of the typescript.  The price is that cursor
+  /// movement cannot reach lines that have already been written: the
+  /// cursor up command stops at the oldest line still held and a
+  /// reverse line feed there inserts a new line instead of returning
+  /// to the written one.  Output is identical to the normal mode for
+  /// typescripts that never move the cursor up past the top of the
+  /// screen.
+  ///
+  /// write_to must still be called at the end to write the lines
+  /// that are left on the screen.
+  ///
+  /// The lines kept are the last \a height (see set_height), so a
+  /// height taken from the script header applies here too.
+  ///
+  /// \param out the receiver of committed lines
+  void stream_to(LineSink& out){
+    stream_out = &out;
+    commit_lines();
+  }
+
+  /// \brief Write the lines in format \a f, keeping the styles of the
+  /// \brief characters unless it is TEXT.  Must be called before
+  /// \brief anything is read.
+  void set_format(Format f){
+    format = f;
+    if(f != typescript2txt::TEXT){
+      lines.keep_styles();
+    }
+  }
+
+  /// \brief Make the screen \a screen_width columns wide
+  ///
+  /// Lines are wrapped at the right edge and each line has room for
+  /// this many characters reserved when it is first written.  Must be
+  /// called before anything is read.
+  ///
+  /// \param screen_width the number of columns.  Must be at least 1.
+  void set_width(std::size_t screen_width){
+    assert(screen_width >= 1);
+    width = screen_width;
+    lines.set_line_reserve(width);
+  }
+
+  /// \brief Take the width (if \a use_width) and the height (if \a
+  /// \brief use_height) from the header that script writes, if the
+  /// \brief input starts with one
+  ///
+  /// See read_script_header.  A size the header does not give is left
+  /// as it is.
+  void size_from_header(bool use_width, bool use_height){
+    header_width = use_width;
+    header_height = use_height;
+  }
+
+  /// \brief Make the screen \a screen_height lines high, resetting
+  /// \brief the scroll region to the whole screen
+  ///
+  /// \param screen_height the number of lines on the screen.  Must be
+  ///                      at least 1.
+  void set_height(std::size_t screen_height){
+    assert(screen_height >= 1);
+    height = screen_height;
+    scroll_top = 0;
+    scroll_bottom = height - 1;
+    follow_cursor();
+  }
+
+  /// \brief Read the input as UTF-8 if \a on is true, otherwise as one
+  /// \brief character per byte
+  ///
+  /// The typescript can change this itself with ESC % G and ESC % @.
+  void set_utf8(bool on){
+    utf8 = on;
+    table = on ? &utf8_transitions : &transitions;
+    find_run_end = on ? find_special_char : find_control_char;
+  }
+
+  /// Return true if the input is being read as UTF-8
+  bool reads_utf8() const{
+    return utf8;
+  }
+
+  /// \brief Count positions in the input (for warnings) as if \a
+  /// \brief offset bytes had been read before the next one
+  ///
+  /// For readers that start in the middle of the input
+  void start_at(uint64_t offset){
+    bytes_before = offset;
+  }
+
+  /// \brief Return true if this reader is in the state that a new
+  /// \brief reader starts in, apart from the lines above the cursor
+  ///
+  /// That is, no escape or UTF-8 sequence is pending and the cursor is
+  /// at the start of an empty last line.  (Whether the input is read as
+  /// UTF-8 is up to the caller to compare.)  A reader that started in the
+  /// middle of the input computed exactly what this one would if it
+  /// read the same bytes next, provided this is true and the other
+  /// reader never needed_earlier_lines.
+  bool at_fresh_line() const{
+    return state == SAW_NOTHING && utf8_have == 0 && char_idx == 0 &&
+      line_idx + 1 == lines.size() && lines.length(line_idx) == 0 &&
+      !has_scroll_region();
+  }
+
+  /// \brief Return true if something this reader did depended on the
+  /// \brief lines above the first one it saw
+  bool needed_earlier_lines() const{
+    return needs_earlier;
+  }
+
+  /// \brief Continue as if this reader had also read the input that
+  /// \brief \a later read
+  ///
+  /// \a later must have started reading where this reader stopped,
+  /// this reader must be at_fresh_line and \a later must not have
+  /// needed_earlier_lines.  The lines of \a later are copied after
+  /// the lines of this reader (its first line replacing this reader's
+  /// empty last line) and its state and warnings are taken over.  The
+  /// screen ends up where it would have if this reader had read the
+  /// input itself.
+  void append(Reader& later){
+    assert(at_fresh_line());
+    assert(!later.needs_earlier);
+    std::size_t base = lines.size() - 1;
+    for(std::size_t i = 0; i < later.lines.size(); ++i){
+      if(i > 0){
+	lines.push_back();
+      }
+      lines.write(base + i, 0, later.lines.data(i), later.lines.length(i));
+      if(later.lines.non_ascii(i)){
+	lines.mark_non_ascii(base + i);
+      }
+    }
+    line_idx = base + later.line_idx;
+    char_idx = later.char_idx;
+    if(later.screen_top > 0){
+      //later's screen moved past its first line, so it is where ours
+      //would be
+      screen_top = base + later.screen_top;
+    }else{
+      //Our screen scrolls only if the cursor went below its bottom
+      screen_top = std::max(screen_top, 
+			    base + later.deepest_line + 1 - 
+			    std::min(base + later.deepest_line + 1, height));
+    }
+    scroll_top = later.scroll_top;
+    scroll_bottom = later.scroll_bottom;
+    deepest_line = std::max(deepest_line, base + later.deepest_line);
+    params = later.params;
+    state = later.state;
+    set_utf8(later.utf8);
+    std::copy(later.utf8_pending, later.utf8_pending + 4, utf8_pending);
+    utf8_have = later.utf8_have;
+    bytes_before = later.bytes_before;
+    diag.absorb(later.diag);
+  }
+
+  /// \brief Append the state of this reader to \a out
+  ///
+  /// A reader given the state with restore continues exactly as this
+  /// one would when it reads the bytes after the last one this one
+  /// read.  Everything is saved except the warnings given so far and
+  /// where committed lines are streamed to.
+  void save(std::string& out) const;
+
+  /// \brief Take the state saved by save from \a p, advancing \a p
+  /// \brief past it
+  ///
+  /// \return false (leaving this reader in an unspecified state) if
+  ///         [p, end) does not start with a saved state
+  bool restore(const char*& p, const char* end);
+
+  /// \brief Write the lines of the screen to \a out, leaving out blank
+  /// \brief lines below the cursor
+  void write_screen(LineWriter& out) const{
+    std::size_t last = std::min(lines.size(), screen_top + height);
+    while(last > line_idx + 1 && lines.length(last - 1) == 0){
+      --last;
+    }
+    for(std::size_t i = screen_top; i < last; ++i){
+      out.write_line(lines.data(i), lines.length(i));
+    }
+  }
+
+  /// \brief Process the typescript bytes in [begin, end) using the
+  /// \brief reader's current state
+  ///
+  /// This is where all input ends up: the other ways of reading only
+  /// collect bytes into blocks and pass them here.  A block may end in
+  /// the middle of an escape sequence; the next call continues where
+  /// the last one stopped.
+  ///
+  /// \param begin the first byte to process
+  ///
+  /// \param end one past the last byte to process
+  void read_from(const char* begin, const char* end);
+
+  /// \brief Write the contents of this reader to the given writer
+  ///
+  /// The contents of the reader are the interpreted inputs it has
   /// read, not those inputs themselves.
-  void write_to(std::ostream& out) const{
-    std::vector<std::vector<char> >::const_iterator line;
-    for(line = lines.begin(); line != lines.end(); ++line){
-      std::vector<std::vector<char> >::const_iterator next_line = line;
-      ++next_line;
-      std::vector<char>::const_iterator ch;
-      for(ch = line->begin(); ch != line->end(); ++ch){
-	out << *ch;
+  ///
+  /// In streaming mode, only the lines that have not been written yet
+  /// are written.
+  void write_to(LineSink& out){
+    std::size_t count = lines_to_write();
+    for(std::size_t i = 0; i < count; ++i){
+      out.line(output_line(i));
+    }
+  }
+
+  /// \brief Write the contents of this reader to the given stream
+  ///
+  /// Same as the LineSink version, for callers that have a stream.
+  void write_to(std::ostream& out){
+    std::size_t count = lines_to_write();
+    for(std::size_t i = 0; i < count; ++i){
+      std::string_view line = output_line(i);
+      out.write(line.data(), line.size());
+      out.put('\n');
+    }
+  }
+};
+
+/// \brief Passes the bytes of a typescript to a Reader, holding back
+/// \brief its start until it is known whether that is a whole script
+/// \brief header
+///
+/// The reader only recognizes the header at the start of the first
+/// block it reads, so when the input arrives in pieces (from a slow
+/// pipe, a decompressor or a file that is still being written) the
+/// header line is collected here however it is split.  Bytes that
+/// cannot start a header pass straight through.
+class HeaderFeed{
+  /// The reader the bytes go to
+  Reader& reader;
+
+  /// The first bytes of the typescript, held back until they hold a
+  /// whole header line or cannot grow into one
+  std::string head;
+
+  /// True once the bytes in head have been passed to the reader
+  bool past_head;
+
+  /// \brief Return true if head can no longer grow into a header line
+  /// \brief or already holds one
+  bool head_complete() const{
+    static const char prefix[] = "Script started on ";
+    const std::size_t prefix_len = sizeof(prefix) - 1;
+    const std::size_t n = std::min(head.size(), prefix_len);
+    //A header line is a few hundred bytes; give up on anything longer
+    return std::memcmp(head.data(), prefix, n) != 0 || 
+      head.find('\n') != std::string::npos || head.size() > 4096;
+  }
+
+  HeaderFeed(const HeaderFeed&);
+  HeaderFeed& operator=(const HeaderFeed&);
+public:
+  /// Feed \a r, which must not have read anything yet
+  explicit HeaderFeed(Reader& r):reader(r),past_head(false){}
+
+  /// Process the bytes in [\a begin, \a end), the next of the typescript
+  void feed(const char* begin, const char* end){
+    if(past_head){
+      reader.read_from(begin, end);
+      return;
+    }
+    head.append(begin, end);
+    if(head_complete()){
+      finish();
+    }
+  }
+
+  /// \brief Pass on anything still held back.  Call at the end of the
+  /// \brief input, before writing the reader's lines.
+  void finish(){
+    if(past_head){
+      return;
+    }
+    past_head = true;
+    reader.read_from(head.data(), head.data() + head.size());
+    std::string().swap(head);
+  }
+};
+
+#ifndef TYPESCRIPT2TXT_LIBRARY //Only the command line saves readers
+
+/// \brief Append \a v to \a out seven bits at a time, lowest first,
+/// \brief with the top bit of each byte set if more bytes follow
+static void put_number(std::string& out, uint64_t v){
+  while(v >= 0x80){
+    out += char((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+  out += char(v);
+}
+
+/// \brief Read a number written by put_number from \a p, advancing
+/// \brief \a p past it
+///
+/// \return false if [p, end) does not start with a whole number
+static bool get_number(const char*& p, const char* end, uint64_t& v){
+  v = 0;
+  for(unsigned shift = 0; p != end && shift < 64; shift += 7){
+    unsigned char b = *p++;
+    v |= uint64_t(b & 0x7F) << shift;
+    if(b < 0x80){
+      return true;
+    }
+  }
+  return false;
+}
+
+/// The version written by Reader::save, changed whenever its format does
+static const uint64_t reader_state_version = 1;
+
+void Reader::save(std::string& out) const{
+  put_number(out, reader_state_version);
+  put_number(out, width);
+  put_number(out, height);
+  put_number(out, line_idx);
+  put_number(out, char_idx);
+  put_number(out, screen_top);
+  put_number(out, scroll_top);
+  put_number(out, scroll_bottom);
+  put_number(out, deepest_line);
+  put_number(out, bytes_before);
+  put_number(out, needs_earlier);
+  put_number(out, utf8);
+  put_number(out, utf8_have);
+  out.append(reinterpret_cast<const char*>(utf8_pending), utf8_have);
+  put_number(out, state);
+  put_number(out, params.size());
+  for(std::size_t i = 0; i < params.size() && i < CSIParams::max_params; ++i){
+    put_number(out, params.at(i));
+  }
+  put_number(out, lines.size());
+  for(std::size_t i = 0; i < lines.size(); ++i){
+    put_number(out, lines.length(i) * 2 + lines.non_ascii(i));
+    out.append(lines.data(i), lines.length(i));
+  }
+}
+
+bool Reader::restore(const char*& p, const char* end){
+  uint64_t v[13];
+  for(std::size_t k = 0; k < 13; ++k){
+    if(!get_number(p, end, v[k])){ return false; }
+  }
+  if(v[0] != reader_state_version || v[1] == 0 || v[2] == 0 || 
+     v[1] > max_screen_size || v[2] > max_screen_size ||
+     v[12] > sizeof(utf8_pending) || (uint64_t)(end - p) < v[12]){
+    return false;
+  }
+  set_width(v[1]);
+  height = v[2];
+  line_idx = v[3];
+  char_idx = v[4];
+  screen_top = v[5];
+  scroll_top = v[6];
+  scroll_bottom = v[7];
+  deepest_line = v[8];
+  bytes_before = v[9];
+  needs_earlier = v[10] != 0;
+  set_utf8(v[11] != 0);
+  utf8_have = v[12];
+  std::copy(p, p + utf8_have, utf8_pending);
+  p += utf8_have;
+  uint64_t st, count, num_lines;
+  if(!get_number(p, end, st) || st >= num_states ||
+     !get_number(p, end, count)){
+    return false;
+  }
+  state = RState(st);
+  params.clear();
+  for(uint64_t i = 0; i < count; ++i){
+    uint64_t value = 0;
+    if(i < CSIParams::max_params && !get_number(p, end, value)){
+      return false;
+    }
+    params.push_back(value);
+  }
+  if(!get_number(p, end, num_lines) || num_lines == 0){
+    return false;
+  }
+  lines.erase_back(lines.size());
+  for(uint64_t i = 0; i < num_lines; ++i){
+    uint64_t len;
+    if(!get_number(p, end, len) || (uint64_t)(end - p) < len / 2){
+      return false;
+    }
+    lines.push_back();
+    lines.write(i, 0, p, len / 2);
+    if(len % 2){
+      lines.mark_non_ascii(i);
+    }
+    p += len / 2;
+  }
+  //The cursor must be somewhere a line can grow to (see LineStore)
+  return line_idx < lines.size() && screen_top < lines.size() &&
+    deepest_line < lines.size() && scroll_top <= scroll_bottom && 
+    scroll_bottom < height && char_idx < 0x40000000u;
+}
+
+#endif
+
+const char* Reader::read_script_header(const char* begin, const char* end){
+  std::size_t cols, rows;
+  const char* line_end = script_header_size(begin, end, cols, rows);
+  if(line_end == NULL){
+    return begin;
+  }
+  if(header_width && cols > 0){ set_width(cols); }
+  if(header_height && rows > 0){ set_height(rows); }
+  const char* text_end = line_end;
+  if(text_end != begin && text_end[-1] == '\r'){
+    --text_end;
+  }
+  cur_line().write(0, begin, text_end - begin);
+  if(std::find_if(begin, text_end, [](char c){ return (c & 0x80) != 0; }) 
+     != text_end){
+    cur_line().mark_non_ascii();
+  }
+  carriage_return();
+  line_feed();
+  return line_end + 1;
+}
+
+void Reader::read_from(const char* begin, const char* end){
+  const char* start = begin;
+  if(block_begin == NULL && bytes_before == 0){
+    start = read_script_header(begin, end);
+  }
+  block_begin = begin;
+  if(utf8_have > 0){
+    pos = begin;
+    start = read_utf8(begin, end);
+  }
+  for(const char* cur = start; cur != end; ++cur){
+    pos = cur;
+    unsigned char c = *cur;
+    if(state == SAW_NOTHING && !may_be_control_char(c) 
+       && !(utf8 && c >= 0x80)){
+      //Fast path: write the whole run of printable characters at once
+      const char* run_end = find_run_end(cur, end);
+      put_chars(cur, run_end - cur);
+      cur = run_end - 1;
+      continue;
+    }
+    const Transition t = (*table)[state][c];
+    switch(t.action){
+    case ACT_NONE: break;
+    case ACT_PRINT: put_char(c); break;
+    case ACT_UTF8: cur = read_utf8(cur, end) - 1; break;
+    case ACT_BACK_SPACE: back_space(); break;
+    case ACT_TAB: tab(); break;
+    case ACT_NEWLINE: carriage_return(); line_feed(); break;
+    case ACT_CARRIAGE_RETURN:
+      carriage_return();
+      if(state == SAW_NOTHING){
+	cur = overwrite_segments(cur + 1, end) - 1;
+      }
+      break;
+    case ACT_LINE_FEED: line_feed(); break;
+    case ACT_REVERSE_LINE_FEED: reverse_line_feed(); break;
+    case ACT_SHIFT_OUT: character_set(1); break;
+    case ACT_SHIFT_IN: character_set(0); break;
+    case ACT_SET_HTAB_STOP: set_htab_stop(); break;
+    case ACT_SAVE_CURSOR: save_cursor_state(); break;
+    case ACT_RESTORE_CURSOR: restore_cursor_state(); break;
+    case ACT_UNKNOWN: unknown_code(state_context(state), c); break;
+    case ACT_CSI_PRIVATE:
+      params.set_private();
+      if(params.size() != 0){
+	if(std::ostream* out = warn("private marker after CSI parameters", c)){
+	  *out << "typescript contains badly formatted CSI code. "
+	       << "The " << c << " character appears in the parameter list "
+	       << "but is not the first character.  Ignoring.\n";
+	}
+      }
+      break;
+    case ACT_CSI_DIGIT: params.add_digit(c-'0'); break;
+    case ACT_CSI_SEPARATOR: params.separator(); break;
+    case ACT_CSI_INSERT_BLANK: insert_blank(params); break;
+    case ACT_CSI_CURSOR_UP: cursor_up(params); break;
+    case ACT_CSI_CURSOR_DOWN: cursor_down(params); break;
+    case ACT_CSI_CURSOR_RIGHT: cursor_right(params); break;
+    case ACT_CSI_ERASE_LINE: erase_line(params); break;
+    case ACT_CSI_DELETE_CHARACTERS: delete_characters(params); break;
+    case ACT_CSI_CURSOR_POSITION: cursor_position(params); break;
+    case ACT_CSI_LINE_POSITION: line_position(params); break;
+    case ACT_CSI_COLUMN_POSITION: column_position(params); break;
+    case ACT_CSI_ERASE_DISPLAY: erase_display(params); break;
+    case ACT_CSI_INSERT_LINES: insert_lines(params); break;
+    case ACT_CSI_DELETE_LINES: delete_lines(params); break;
+    case ACT_CSI_SET_SCROLL_REGION: set_scroll_region(params); break;
+    case ACT_CSI_SELECT_GRAPHIC_RENDITION:
+      if(format != typescript2txt::TEXT){
+	select_graphic_rendition(params);
+      }
+      break;
+    case ACT_CSI_UNIMPLEMENTED: 
+      unimplemented_CSI(c, csi_description(c), params); 
+      break;
+    case ACT_SELECT_CHARACTER_SET: select_character_set(c); break;
+    case ACT_SCREEN_ALIGNMENT:
+      if(std::ostream* out = warn("DEC screen alignment (ESC # 8) ignored")){
+	*out << "typescript file contains DEC screen "
+	     << "alignment command which is ignored "
+	     << "by this translator.\n";
+      }
+      break;
+    case ACT_DEFINE_G0: define_g_character_set(0,c); break;
+    case ACT_DEFINE_G1: define_g_character_set(1,c); break;
+    case ACT_RESET_PALETTE: reset_palette(); break;
+    case ACT_PALETTE_DIGIT: palette_digit(c); break;
+    }
+    if(t.next != STAY){
+      set_state(RState(t.next));
+    }
+  }
+  bytes_before += end - begin;
+}
+
+constexpr Reader::TransitionTable Reader::transitions =
+  Reader::make_transitions(false);
+
+constexpr Reader::TransitionTable Reader::utf8_transitions =
+  Reader::make_transitions(true);
+
+} // namespace
+
+namespace typescript2txt{
+
+struct Converter::Impl{
+  /// Interprets the typescript
+  Reader reader;
+
+  /// Receives the lines the reader commits
+  LineSink& sink;
+
+  /// Passes the bytes fed to the reader, recognizing the script header
+  /// however it is split between calls to feed
+  HeaderFeed input;
+
+  Impl(LineSink& sink):sink(sink),input(reader){}
+};
+
+Converter::Converter(LineSink& sink, const Settings& settings)
+  :impl(new Impl(sink)){
+  Reader& r = impl->reader;
+  if(settings.width){ r.set_width(std::min(settings.width, max_screen_size)); }
+  if(settings.height){ 
+    r.set_height(std::min(settings.height, max_screen_size)); 
+  }
+  r.size_from_header(settings.width == 0, settings.height == 0);
+  r.set_utf8(settings.utf8);
+  r.set_format(settings.format);
+  if(settings.warnings){
+    r.diagnostics().set_output(*settings.warnings);
+  }else{
+    r.diagnostics().set_mode(Diagnostics::NONE);
+  }
+  r.stream_to(sink);
+}
+
+Converter::~Converter(){}
+
+void Converter::feed(const char* data, std::size_t len){
+  impl->input.feed(data, data + len);
+}
+
+void Converter::finish(){
+  impl->input.finish();
+  impl->reader.write_to(impl->sink);
+  impl->reader.diagnostics().summarize();
+}
+
+} // namespace typescript2txt
+
+#ifndef TYPESCRIPT2TXT_LIBRARY
+
+namespace{
+
+/// The kinds of input read_fd recognizes by their first bytes
+enum Compression{
+  UNCOMPRESSED, ///A typescript as script wrote it
+  GZIP, ///gzip, one member or several (as cat a.gz b.gz makes)
+  ZSTD ///zstd, one frame or several
+};
+
+/// Return the kind of input that starts with the \a n bytes at \a p
+Compression compression_of(const char* p, std::size_t n){
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  if(n >= 2 && u[0] == 0x1F && u[1] == 0x8B){
+    return GZIP;
+  }
+  if(n >= 4 && u[0] == 0x28 && u[1] == 0xB5 && u[2] == 0x2F && u[3] == 0xFD){
+    return ZSTD;
+  }
+  return UNCOMPRESSED;
+}
+
+/// Return the name of \a kind for messages
+const char* compression_name(Compression kind){
+  return kind == GZIP ? "gzip" : kind == ZSTD ? "zstd" : "uncompressed";
+}
+
+/// \brief If the \a n bytes at \a p start a compressed file, say that
+/// \brief \a option cannot read \a name and return true
+bool refuse_compressed(const char* p, std::size_t n, const char* name,
+		       const char* option){
+  Compression kind = compression_of(p, n);
+  if(kind == UNCOMPRESSED){
+    return false;
+  }
+  std::cerr << "ERROR: " << name << " is compressed with " 
+	    << compression_name(kind) << ", which " << option 
+	    << " cannot read.  Decompress it first.\n";
+  return true;
+}
+
+/// \brief The compressed bytes of an input: bytes in memory (a mapped
+/// \brief file, or the start of a stream that has already been read),
+/// \brief followed by whatever can still be read from a descriptor
+class CompressedSource{
+  /// The bytes in memory not handed out yet
+  const char* cur;
+  /// One past the last byte in memory
+  const char* end;
+  /// The descriptor read after the memory, -1 for none
+  int fd;
+  /// The name of the input, for messages
+  const char* name;
+  /// The block the descriptor is read into
+  std::vector<char> buf;
+public:
+  /// The number of bytes handed out so far
+  uint64_t total;
+
+  /// Read [\a begin, \a end) and then \a fd (unless it is -1) to its end
+  CompressedSource(const char* begin, const char* end, int fd, 
+		   const char* name)
+    :cur(begin),end(end),fd(fd),name(name),total(0){}
+
+  /// \brief Set \a p and \a n to the next bytes, \a n to 0 at the end
+  ///
+  /// \return false if there was a read error, which has been described
+  ///         in \a error
+  bool next(const char*& p, std::size_t& n, std::string& error){
+    if(cur != end){
+      //zlib counts in 32 bits, so hand out large memory in pieces
+      n = std::min<std::size_t>(end - cur, 1u << 30);
+      p = cur;
+      cur += n;
+      total += n;
+      return true;
+    }
+    n = 0;
+    if(fd < 0){
+      return true;
+    }
+    buf.resize(1024*1024);
+    for(;;){
+      ssize_t got = read(fd, &buf.front(), buf.size());
+      if(got >= 0){
+	p = &buf.front();
+	n = got;
+	total += n;
+	return true;
+      }
+      if(errno != EINTR){
+	error = std::string("could not read ") + name + ": " + 
+	  std::strerror(errno);
+	return false;
+      }
+    }
+  }
+};
+
+/// What a thread reading (and perhaps decompressing) the input into
+/// a BlockRing did
+struct InputResult{
+  /// Empty on success, otherwise what went wrong
+  std::string error;
+  /// How the input was compressed
+  Compression kind;
+  /// The number of bytes read from the input
+  uint64_t read;
+  /// The number of bytes passed to the parser
+  uint64_t bytes;
+  /// The time spent reading and decompressing
+  double busy;
+  /// The time spent waiting for the parser to release a block
+  double waiting;
+  /// True if bytes after the last gzip member were not gzip data and
+  /// were ignored
+  bool trailing_garbage;
+  /// If trailing_garbage, the position in the compressed input of the
+  /// first ignored byte
+  uint64_t garbage_offset;
+
+  InputResult():kind(UNCOMPRESSED),read(0),bytes(0),busy(0),waiting(0),
+		trailing_garbage(false),garbage_offset(0){}
+};
+
+/// \brief Decompress everything \a in holds (in format \a kind) into
+/// \brief the blocks of \a ring, then close it
+///
+/// Runs on its own thread, so that decompression overlaps parsing.
+/// Several gzip members or zstd frames one after the other are read
+/// as one stream, as gzip -d and zstd -d do.  Like gzip -d, anything
+/// after a gzip member that does not start another (e.g. the zero
+/// padding tar and dd leave) ends the input instead of being an error.
+void decompress(Compression kind, CompressedSource& in, BlockRing& ring,
+		InputResult& result){
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+#ifdef HAVE_ZSTD
+  ZSTD_DStream* zds = NULL;
+#endif
+  if(kind == GZIP){
+    if(inflateInit2(&zs, 15 + 16) != Z_OK){
+      result.error = "could not start gzip decompression";
+    }
+  }else{
+#ifdef HAVE_ZSTD
+    zds = ZSTD_createDStream();
+    if(zds == NULL || ZSTD_isError(ZSTD_initDStream(zds))){
+      result.error = "could not start zstd decompression";
+    }
+#else
+    result.error = "this typescript2txt was built without zstd support "
+      "(build it with make HAVE_ZSTD=1)";
+#endif
+  }
+  bool frame_open = false; //True if the last member or frame is unfinished
+  bool first_member = true;
+  const char* p;
+  std::size_t n;
+  while(result.error.empty() && !result.trailing_garbage && 
+	in.next(p, n, result.error) && n > 0){
+    std::size_t used = 0;
+    while(used < n || frame_open){
+      const Clock::time_point wait_start = Clock::now();
+      char* out = ring.next_free();
+      result.waiting += std::chrono::duration<double>
+	(Clock::now() - wait_start).count();
+      std::size_t produced;
+      bool more_output; //True if the output block was filled
+      if(kind == GZIP){
+	if(!frame_open && used < n){
+	  static const unsigned char magic[2] = {0x1f, 0x8b};
+	  if(!first_member && 
+	     std::memcmp(p + used, magic, std::min<std::size_t>(n - used, 2))){
+	    result.trailing_garbage = true;
+	    result.garbage_offset = in.total - (n - used);
+	    break;
+	  }
+	  inflateReset(&zs); //The start of another member
+	  first_member = false;
+	}
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p + used));
+	zs.avail_in = n - used;
+	zs.next_out = reinterpret_cast<Bytef*>(out);
+	zs.avail_out = ring.capacity();
+	int ret = inflate(&zs, Z_NO_FLUSH);
+	used = n - zs.avail_in;
+	produced = ring.capacity() - zs.avail_out;
+	more_output = zs.avail_out == 0;
+	if(ret == Z_STREAM_END){
+	  frame_open = false;
+	}else if(ret == Z_OK || ret == Z_BUF_ERROR){
+	  frame_open = true;
+	}else{
+	  result.error = std::string("corrupt gzip data: ") + 
+	    (zs.msg ? zs.msg : "unknown error");
+	}
+      }else{
+#ifdef HAVE_ZSTD
+	ZSTD_inBuffer zin = {p, n, used};
+	ZSTD_outBuffer zout = {out, ring.capacity(), 0};
+	std::size_t ret = ZSTD_decompressStream(zds, &zout, &zin);
+	used = zin.pos;
+	produced = zout.pos;
+	more_output = zout.pos == zout.size;
+	if(ZSTD_isError(ret)){
+	  result.error = std::string("corrupt zstd data: ") + 
+	    ZSTD_getErrorName(ret);
+	}
+	frame_open = ret != 0;
+#else
+	produced = 0;
+	more_output = false;
+#endif
+      }
+      if(produced > 0){
+	ring.publish(produced);
+	result.bytes += produced;
+      }
+      if(!result.error.empty() || (used == n && !more_output)){
+	break; //Done, or more input is needed to go on
+      }
+    }
+  }
+  if(result.error.empty() && frame_open){
+    result.error = std::string("the ") + compression_name(kind) + 
+      " data ends too early (is the file complete?)";
+  }
+  if(kind == GZIP){
+    inflateEnd(&zs);
+  }
+#ifdef HAVE_ZSTD
+  ZSTD_freeDStream(zds);
+#endif
+  result.kind = kind;
+  result.read = in.total;
+  ring.close();
+  result.busy = std::chrono::duration<double>(Clock::now() - start).count()
+    - result.waiting;
+}
+
+/// \brief Read everything from \a fd (named \a name) into the blocks
+/// \brief of \a ring, decompressing it if it is compressed, then close it
+///
+/// The input thread of read_pipelined.
+void read_input(int fd, const char* name, BlockRing& ring, 
+		InputResult& result){
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  char* block = ring.next_free();
+  std::size_t filled = 0;
+  for(;;){
+    ssize_t got = read(fd, block + filled, ring.capacity() - filled);
+    if(got < 0 && errno == EINTR){
+      continue;
+    }
+    if(got < 0){
+      result.error = std::string("could not read ") + name + ": " + 
+	std::strerror(errno);
+      break;
+    }
+    result.read += got;
+    filled += got;
+    if(result.read == filled){
+      if(got > 0 && filled < 4){
+	continue; //Too few bytes to tell whether they are compressed
+      }
+      Compression kind = compression_of(block, filled);
+      if(kind != UNCOMPRESSED){
+	const std::vector<char> head(block, block + filled);
+	CompressedSource in(&head.front(), &head.front() + filled, fd, name);
+	decompress(kind, in, ring, result);
+	return;
+      }
+    }
+    if(filled == ring.capacity() || (got == 0 && filled > 0)){
+      ring.publish(filled);
+      result.bytes += filled;
+      filled = 0;
+      const Clock::time_point wait_start = Clock::now();
+      block = ring.next_free();
+      result.waiting += std::chrono::duration<double>
+	(Clock::now() - wait_start).count();
+    }
+    if(got == 0){
+      break;
+    }
+  }
+  ring.close();
+  result.busy = std::chrono::duration<double>(Clock::now() - start).count()
+    - result.waiting;
+}
+
+/// \brief Feed \a r the blocks of \a ring as \a worker (which
+/// \brief reports in \a result) publishes them, until it closes the ring
+///
+/// \param name the name of the input, used in messages
+///
+/// \param report if not NULL, where to describe the time each of the
+///        two threads spent working and waiting
+///
+/// \return true on success, false if there was an error (which has
+///         already been reported on std::cerr)
+bool parse_blocks(Reader& r, BlockRing& ring, std::thread& worker, 
+		  const InputResult& result, const char* name, 
+		  std::ostream* report){
+  typedef std::chrono::steady_clock Clock;
+  double parsing = 0, waiting = 0;
+  const char* data;
+  std::size_t size;
+  HeaderFeed feed(r);
+  for(;;){
+    const Clock::time_point wait_start = Clock::now();
+    bool more = ring.next_full(data, size);
+    const Clock::time_point parse_start = Clock::now();
+    waiting += std::chrono::duration<double>(parse_start - wait_start).count();
+    if(!more){
+      feed.finish();
+      break;
+    }
+    feed.feed(data, data + size);
+    ring.release();
+    parsing += std::chrono::duration<double>(Clock::now() - parse_start).count();
+  }
+  worker.join();
+  if(!result.error.empty()){
+    std::cerr << "ERROR: " << name << ": " << result.error << "\n";
+    return false;
+  }
+  if(result.trailing_garbage){
+    if(std::ostream* o = r.diagnostics().report
+       ("data after the compressed input ignored", Diagnostics::no_code,
+	result.bytes)){
+      *o << "the bytes of " << name << " from byte " 
+	 << result.garbage_offset << " on are not gzip data and were "
+	 << "ignored\n";
+    }
+  }
+  if(report != NULL){
+    const double mb = result.bytes / 1e6;
+    *report << std::fixed << std::setprecision(3) << name << ": ";
+    if(result.kind == UNCOMPRESSED){
+      *report << mb << " MB read\n"
+	      << "  reading:       " << result.busy << " s busy ("
+	      << mb / std::max(result.busy, 1e-9) << " MB/s), ";
+    }else{
+      *report << compression_name(result.kind) << " input of " 
+	      << result.read / 1e6 << " MB decompressed to " << mb << " MB\n"
+	      << "  decompression: " << result.busy << " s busy ("
+	      << mb / std::max(result.busy, 1e-9) << " MB/s of output), ";
+    }
+    *report << result.waiting << " s waiting for the parser\n"
+	    << "  parsing:       " << parsing << " s busy ("
+	    << mb / std::max(parsing, 1e-9) << " MB/s), " << waiting
+	    << " s waiting for input\n";
+    report->unsetf(std::ios::floatfield);
+    *report << std::setprecision(6);
+  }
+  return true;
+}
+
+/// \brief Feed \a r the decompressed contents of \a in, which is
+/// \brief compressed as \a kind
+///
+/// A second thread decompresses into a BlockRing while this one parses
+/// the blocks it has finished.
+///
+/// \param report if not NULL, where to describe the time each of the
+///        two threads spent working and waiting
+///
+/// \return true on success, false if there was an error (which has
+///         already been reported on std::cerr)
+bool read_compressed(Reader& r, Compression kind, CompressedSource& in,
+		     const char* name, std::ostream* report){
+  BlockRing ring(16, 256*1024);
+  InputResult result;
+  std::thread worker(decompress, kind, std::ref(in), std::ref(ring), 
+		     std::ref(result));
+  return parse_blocks(r, ring, worker, result, name, report);
+}
+
+/// \brief Writes the blocks published in its BlockRing to a descriptor
+/// \brief on a thread of its own
+///
+/// The last stage of --pipeline: a LineWriter made for blocks() hands
+/// over each full buffer of lines, and the write system calls (and any
+/// wait for the disk or a slow pipe) happen here while parsing goes on.
+class OutputThread{
+  /// The buffers of lines waiting to be written
+  BlockRing ring;
+  /// Where they are written
+  int fd;
+  /// The errno of the first failed write or 0 if none failed
+  int error;
+  /// The thread running run()
+  std::thread thread;
+
+  /// Write every block published until the ring is closed
+  void run(){
+    LineWriter out(fd, 0);
+    const char* data;
+    std::size_t size;
+    while(ring.next_full(data, size)){
+      out.write_raw(data, size); //Does nothing once a write has failed
+      ring.release();
+    }
+    error = out.write_error();
+  }
+
+  OutputThread(const OutputThread&);
+  OutputThread& operator=(const OutputThread&);
+public:
+  /// Start the thread writing to \a fd
+  explicit OutputThread(int fd)
+    :ring(8, 1024*1024),fd(fd),error(0),thread(&OutputThread::run, this){}
+
+  ~OutputThread(){ finish(); }
+
+  /// Return the queue to publish blocks of output in
+  BlockRing& blocks(){ return ring; }
+
+  /// \brief Wait until every block published so far has been written,
+  /// \brief then stop the thread
+  ///
+  /// \return the errno of the first failed write or 0 if none failed
+  int finish(){
+    if(thread.joinable()){
+      ring.close();
+      thread.join();
+    }
+    return error;
+  }
+};
+
+/// \brief Feed \a r everything that can be read from \a fd, read (and
+/// \brief decompressed if need be) by a second thread
+///
+/// The input thread reads into a BlockRing while this one parses the
+/// blocks it has finished, so waiting for the disk or a pipe overlaps
+/// parsing.
+///
+/// \param report if not NULL, where to describe the time each of the
+///        two threads spent working and waiting
+///
+/// \return true on success, false if there was an error (which has
+///         already been reported on std::cerr)
+bool read_pipelined(Reader& r, int fd, const char* name, 
+		    std::ostream* report){
+  BlockRing ring(16, 256*1024);
+  InputResult result;
+  std::thread worker(read_input, fd, name, std::ref(ring), std::ref(result));
+  return parse_blocks(r, ring, worker, result, name, report);
+}
+
+/// \brief Feed everything that can be read from \a fd to \a r
+///
+/// Regular files are mapped into memory and handed to the reader in
+/// one piece.  Anything else (pipes, terminals, files that cannot be
+/// mapped) is read in large blocks.  Input compressed with gzip or
+/// zstd (known by its first bytes) is decompressed by read_compressed.
+///
+/// \param r the reader that will process the bytes
+///
+/// \param fd the descriptor to read until end of file
+///
+/// \param name the name of the input, used in error messages
+///
+/// \param report if not NULL, where to describe the time spent
+///        reading or decompressing and parsing on separate threads
+///
+/// \param pipeline if true, read everything with read_pipelined
+///
+/// \return true on success, false if there was a read error (which
+///         has already been reported on std::cerr)
+bool read_fd(Reader& r, int fd, const char* name, std::ostream* report,
+	     bool pipeline){
+  if(pipeline){
+    return read_pipelined(r, fd, name, report);
+  }
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED){
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      const char* begin = static_cast<const char*>(map);
+      const char* end = begin + st.st_size;
+      Compression kind = compression_of(begin, st.st_size);
+      if(kind != UNCOMPRESSED){
+	CompressedSource in(begin, end, -1, name);
+	bool ok = read_compressed(r, kind, in, name, report);
+	munmap(map, st.st_size);
+	return ok;
+      }
+      //Hand over the file in windows, dropping each from memory once it
+      //has been read so that huge files don't fill the resident set
+      const std::size_t window = 64*1024*1024;
+      for(const char* cur = begin; cur != end; ){
+	const char* next = (std::size_t)(end - cur) > window ? cur + window : end;
+	r.read_from(cur, next);
+	madvise(const_cast<char*>(cur), next - cur, MADV_DONTNEED);
+	cur = next;
+      }
+      munmap(map, st.st_size);
+      return true;
+    }
+    //Fall through to read() - e.g. the file system may not support mmap
+  }
+  std::vector<char> block(1024*1024);
+  bool first = true; //True until the first bytes have been checked
+  std::size_t filled = 0;
+  HeaderFeed feed(r);
+  while(true){
+    ssize_t got = read(fd, &block.front() + filled, block.size() - filled);
+    if(got < 0){
+      if(errno == EINTR){ continue; }
+      std::cerr << "ERROR: could not read " << name << ": " 
+		<< std::strerror(errno) << "\n";
+      feed.finish();
+      return false;
+    }
+    filled += got;
+    const char* begin = &block.front();
+    if(first){
+      if(got > 0 && filled < 4){
+	continue; //Too few bytes to tell whether they are compressed
+      }
+      first = false;
+      Compression kind = compression_of(begin, filled);
+      if(kind != UNCOMPRESSED){
+	CompressedSource in(begin, begin + filled, fd, name);
+	return read_compressed(r, kind, in, name, report);
+      }
+    }
+    if(filled == 0){
+      feed.finish();
+      return true;
+    }
+    feed.feed(begin, begin + filled);
+    filled = 0;
+  }
+}
+
+/// \brief Convert the typescript in [begin, end) to text written to
+/// \brief \a out, reading up to \a pieces parts of it at once
+///
+/// The input is cut just after newlines near the ends of \a pieces
+/// equal parts.  Each part is read by its own Reader on its own
+/// thread, on the guess that the reader of the part before it will be
+/// at the start of an empty line with no escape sequence pending
+/// there, which is how a new Reader starts.  The parts are then
+/// appended in order to the reader of the first.  If the guess was
+/// wrong for a part, or its reader needed lines above the ones it
+/// saw, the part is read again by that reader instead.  So the output
+/// is always the same as reading the whole input with one Reader.
+///
+/// \param begin the first byte of the typescript
+///
+/// \param end one past the last byte of the typescript
+///
+/// \param pieces the number of parts to read at once.  Must be at
+///               least 1.
+///
+/// \param width the number of columns on the screen
+///
+/// \param height the number of lines on the screen
+///
+/// \param utf8 true if the input starts out being read as UTF-8.  A
+///             part is also read again if the encoding changed before it.
+///
+/// \param out where the text is written
+///
+/// \param diag receives the warnings of all the parts
+///
+/// \return the number of parts that had to be read again
+std::size_t parse_parallel(const char* begin, const char* end, 
+			   std::size_t pieces, std::size_t width,
+			   std::size_t height, bool utf8,
+			   LineWriter& out, Diagnostics& diag){
+  assert(pieces >= 1);
+  std::vector<const char*> cuts(1, begin);
+  const std::size_t size = end - begin;
+  for(std::size_t k = 1; k < pieces; ++k){
+    const char* target = begin + size / pieces * k;
+    if(target < cuts.back()){ continue; }
+    const void* nl = std::memchr(target, '\n', end - target);
+    if(nl == NULL){ break; }
+    const char* cut = static_cast<const char*>(nl) + 1;
+    if(cut < end){
+      cuts.push_back(cut);
+    }
+  }
+  cuts.push_back(end);
+  const std::size_t parts = cuts.size() - 1;
+
+  std::vector<std::unique_ptr<Reader> > readers(parts);
+  for(std::size_t k = 0; k < parts; ++k){
+    readers[k].reset(new Reader);
+    readers[k]->set_width(width);
+    readers[k]->set_height(height);
+    readers[k]->set_utf8(utf8);
+    readers[k]->diagnostics().set_mode(diag.get_mode());
+    readers[k]->diagnostics().defer();
+    readers[k]->start_at(cuts[k] - begin);
+  }
+  std::vector<std::thread> threads;
+  for(std::size_t k = 1; k < parts; ++k){
+    threads.push_back(std::thread(static_cast<void (Reader::*)
+				  (const char*, const char*)>
+				  (&Reader::read_from),
+				  readers[k].get(), cuts[k], cuts[k+1]));
+  }
+  readers[0]->read_from(cuts[0], cuts[1]);
+  for(std::size_t t = 0; t < threads.size(); ++t){
+    threads[t].join();
+  }
+
+  Reader& whole = *readers[0];
+  std::size_t reread = 0;
+  for(std::size_t k = 1; k < parts; ++k){
+    if(whole.at_fresh_line() && whole.reads_utf8() == utf8 &&
+       !readers[k]->needed_earlier_lines()){
+      whole.append(*readers[k]);
+    }else{
+      whole.read_from(cuts[k], cuts[k+1]);
+      ++reread;
+    }
+    readers[k].reset();
+  }
+  whole.write_to(out);
+  diag.absorb(whole.diagnostics());
+  return reread;
+}
+
+/// The settings given on the command line
+struct Options{
+  /// The files (or in batch mode, files and directories) to read.
+  /// Standard input is read if there are none.
+  std::vector<std::string> inputs;
+  /// If true, write lines as soon as they leave the screen
+  bool stream;
+  /// The number of columns on the screen, 0 to take it from the
+  /// script header (or use 80 if there is none)
+  std::size_t width;
+  /// The number of lines on the screen, 0 to take it from the script
+  /// header (or use 24 if there is none)
+  std::size_t height;
+  /// How warnings about the typescript are reported
+  Diagnostics::Mode diagnostics;
+  /// In batch mode, the directory where the output files are written.
+  /// Empty when not in batch mode.
+  std::string output_dir;
+  /// The number of files converted at once in batch mode
+  std::size_t jobs;
+  /// The number of parts of each file read at once
+  std::size_t threads;
+  /// If true, read the input as UTF-8 from the start
+  bool utf8;
+  /// The timing file of the input, to write the screen as it was at
+  /// \a at seconds.  Empty if not replaying.
+  std::string timing;
+  /// The time into the recording to replay to
+  double at;
+  /// The file holding the replay checkpoints, empty for none
+  std::string index;
+  /// The number of megabytes of typescript between replay checkpoints
+  std::size_t checkpoint_mb;
+  /// The file the text is written to, empty for standard output
+  std::string output;
+  /// The file where the state of the conversion is kept between runs,
+  /// empty if each run starts from the beginning
+  std::string state;
+  /// If true, keep reading the input as it grows, like tail -f
+  bool follow;
+  /// How the lines are written
+  Format format;
+  /// If true, describe the speed of decompressing and of parsing
+  /// compressed input on standard error
+  bool throughput;
+  /// If true, read, parse and write on three threads at once
+  bool pipeline;
+
+  /// Create the default options: read standard input without streaming
+  Options():stream(false),width(0),height(0),diagnostics(Diagnostics::TEXT),
+	    jobs(std::max(1u, std::thread::hardware_concurrency())),threads(1),
+	    utf8(false),at(-1),checkpoint_mb(16),follow(false),
+	    format(typescript2txt::TEXT),throughput(false),pipeline(false){}
+};
+
+/// Print the command line usage to \a out
+void usage(std::ostream& out){
+  out << "Usage: typescript2txt [options] [script_output] > script.txt\n"
+      << "   or: typescript2txt [options] --output-dir=DIR file_or_dir...\n"
+      << "Reads standard input if no file is given.  Input compressed with\n"
+      << "gzip or zstd is decompressed.\n"
+      << "Options:\n"
+      << "  --stream      write lines as soon as they scroll off the screen\n"
+      << "                so memory use does not grow with the input\n"
+      << "  --width=N     the screen has N columns (default: as recorded\n"
+      << "                in the script header, otherwise 80)\n"
+      << "  --height=N    the screen has N lines (default: as recorded in\n"
+      << "                the script header, otherwise 24)\n"
+      << "  --utf8        read the input as UTF-8 (as a typescript can also\n"
+      << "                select with ESC % G) instead of a byte per column\n"
+      << "  --quiet       do not warn about unhandled escape sequences\n"
+      << "  --pipeline    read the input and write the output on threads\n"
+      << "                of their own while the typescript is parsed\n"
+      << "                (with --stream, lines are written while parsing\n"
+      << "                goes on)\n"
+      << "  --throughput  for input compressed with gzip or zstd (which is\n"
+      << "                decompressed on its own thread) or with\n"
+      << "                --pipeline, write how fast it was read and\n"
+      << "                parsed to standard error\n"
+      << "  --format=text|html|ansi\n"
+      << "                html keeps the colours and other attributes as\n"
+      << "                an HTML page, ansi as the fewest escape sequences\n"
+      << "                that reproduce them (default: text)\n"
+      << "  --diagnostics=text|tsv|none\n"
+      << "                text (the default) describes the first occurrence\n"
+      << "                of each warning and ends with a table of counts;\n"
+      << "                tsv writes only that table as tab separated values\n"
+      << "  --output-dir=DIR\n"
+      << "                batch mode: convert every file given (and every\n"
+      << "                file in every directory given) to DIR/name.txt\n"
+      << "                (DIR/name.html with --format=html)\n"
+      << "  --jobs=N      batch mode: convert N files at once (default: the\n"
+      << "                number of processors)\n"
+      << "  --threads=N   read N parts of each file at once (default 1).\n"
+      << "                Only for files that can be mapped into memory\n"
+      << "                and not with --stream or --format.\n"
+      << "  --timing=FILE --at=SECONDS\n"
+      << "                write the screen as it was SECONDS into the\n"
+      << "                recording, using the timing file that script -t\n"
+      << "                (or --log-timing) wrote with the typescript\n"
+      << "  --index=FILE  with --timing: keep checkpoints of the replay in\n"
+      << "                FILE (made if missing or out of date) so a seek\n"
+      << "                reads at most --checkpoint-every MB\n"
+      << "  --checkpoint-every=MB\n"
+      << "                typescript megabytes between checkpoints\n"
+      << "                (default 16)\n"
+      << "  --output=FILE write the text to FILE instead of standard output\n"
+      << "  --state=FILE  with --output: continue from where the last run\n"
+      << "                with this FILE stopped, reading only the bytes\n"
+      << "                added to the input since (implies --stream)\n"
+      << "  --follow      keep reading the file as it grows, like tail -f,\n"
+      << "                writing each line once it leaves the screen\n"
+      << "                (implies --stream); stop with Ctrl-C\n"
+      << "  --help        print this message\n";
+}
+
+/// \brief If \a argv[i] is the option \a name, put its value in
+/// \brief \a value and return true
+///
+/// Accepts both "--name=value" and "--name value".  In the second form
+/// \a i is advanced past the value.
+///
+/// \return true if argv[i] was the option \a name with a value
+bool option_value(const std::string& name, int argc, char** argv, int& i,
+		  std::string& value){
+  std::string arg = argv[i];
+  if(arg.compare(0, name.size() + 1, name + "=") == 0){
+    value = arg.substr(name.size() + 1);
+    return true;
+  }
+  if(arg == name && i + 1 < argc){
+    value = argv[++i];
+    return true;
+  }
+  return false;
+}
+
+/// \brief Parse a positive integer option value, printing an error if
+/// \brief it is not one
+///
+/// \return true if \a value held a positive integer, which is put in
+///         \a result
+bool parse_positive(const std::string& name, const std::string& value, 
+		    std::size_t& result){
+  char* end;
+  unsigned long v = std::strtoul(value.c_str(), &end, 10);
+  if(value.empty() || *end != '\0' || v == 0){
+    std::cerr << "ERROR: " << name << " needs a positive integer, not \""
+	      << value << "\"\n";
+    return false;
+  }
+  result = v;
+  return true;
+}
+
+/// \brief Fill \a opt from the command line, printing a message and
+/// \brief returning false if it is invalid
+bool parse_options(int argc, char** argv, Options& opt){
+  for(int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    std::string value;
+    if(arg == "--help"){
+      usage(std::cout);
+      std::exit(0);
+    }else if(arg == "--stream"){
+      opt.stream = true;
+    }else if(arg == "--utf8"){
+      opt.utf8 = true;
+    }else if(arg == "--follow"){
+      opt.follow = true;
+    }else if(arg == "--throughput"){
+      opt.throughput = true;
+    }else if(arg == "--pipeline"){
+      opt.pipeline = true;
+    }else if(option_value("--width", argc, argv, i, value)){
+      if(!parse_positive("--width", value, opt.width)){ return false; }
+      if(opt.width > max_screen_size){
+	std::cerr << "ERROR: --width must be at most " << max_screen_size 
+		  << "\n";
+	return false;
+      }
+    }else if(option_value("--height", argc, argv, i, value)){
+      if(!parse_positive("--height", value, opt.height)){ return false; }
+      if(opt.height > max_screen_size){
+	std::cerr << "ERROR: --height must be at most " << max_screen_size 
+		  << "\n";
+	return false;
+      }
+    }else if(arg == "--quiet"){
+      opt.diagnostics = Diagnostics::NONE;
+    }else if(option_value("--diagnostics", argc, argv, i, value)){
+      if(value == "text"){
+	opt.diagnostics = Diagnostics::TEXT;
+      }else if(value == "tsv"){
+	opt.diagnostics = Diagnostics::TSV;
+      }else if(value == "none"){
+	opt.diagnostics = Diagnostics::NONE;
+      }else{
+	std::cerr << "ERROR: --diagnostics must be text, tsv or none, not \""
+		  << value << "\"\n";
+	return false;
+      }
+    }else if(option_value("--format", argc, argv, i, value)){
+      if(value == "text"){
+	opt.format = typescript2txt::TEXT;
+      }else if(value == "html"){
+	opt.format = typescript2txt::HTML;
+      }else if(value == "ansi"){
+	opt.format = typescript2txt::ANSI;
+      }else{
+	std::cerr << "ERROR: --format must be text, html or ansi, not \""
+		  << value << "\"\n";
+	return false;
       }
-      //Output a newline unless this is the last line and it is blank
-      //(meaning that it was created by a previous newline but nothing
-      //was written to it)
-      if(! (line->size() == 0 && next_line == lines.end()) ){
-	out << std::endl;
+    }else if(option_value("--output-dir", argc, argv, i, value)){
+      if(value.empty()){
+	std::cerr << "ERROR: --output-dir needs a directory\n";
+	return false;
+      }
+      opt.output_dir = value;
+    }else if(option_value("--jobs", argc, argv, i, value)){
+      if(!parse_positive("--jobs", value, opt.jobs)){ return false; }
+    }else if(option_value("--threads", argc, argv, i, value)){
+      if(!parse_positive("--threads", value, opt.threads)){ return false; }
+    }else if(option_value("--timing", argc, argv, i, value)){
+      opt.timing = value;
+    }else if(option_value("--at", argc, argv, i, value)){
+      char* end;
+      opt.at = std::strtod(value.c_str(), &end);
+      if(value.empty() || *end != '\0' || !(opt.at >= 0)){
+	std::cerr << "ERROR: --at needs a number of seconds, not \""
+		  << value << "\"\n";
+	return false;
+      }
+    }else if(option_value("--index", argc, argv, i, value)){
+      opt.index = value;
+    }else if(option_value("--output", argc, argv, i, value)){
+      opt.output = value;
+    }else if(option_value("--state", argc, argv, i, value)){
+      opt.state = value;
+    }else if(option_value("--checkpoint-every", argc, argv, i, value)){
+      if(!parse_positive("--checkpoint-every", value, opt.checkpoint_mb)){ 
+	return false; 
+      }
+    }else if(arg.size() > 1 && arg[0] == '-'){
+      std::cerr << "ERROR: unknown option " << arg << "\n";
+      usage(std::cerr);
+      return false;
+    }else{
+      opt.inputs.push_back(arg);
+    }
+  }
+  if(opt.output_dir.empty() && opt.inputs.size() > 1){
+    std::cerr << "ERROR: more than one input needs --output-dir\n";
+    usage(std::cerr);
+    return false;
+  }
+  if(!opt.output_dir.empty() && opt.inputs.empty()){
+    std::cerr << "ERROR: --output-dir needs at least one input\n";
+    usage(std::cerr);
+    return false;
+  }
+  if(opt.timing.empty() != (opt.at < 0)){
+    std::cerr << "ERROR: --timing and --at must be given together\n";
+    return false;
+  }
+  if(!opt.output.empty() && !opt.output_dir.empty()){
+    std::cerr << "ERROR: --output and --output-dir cannot be used together\n";
+    return false;
+  }
+  if(!opt.state.empty() && (opt.output.empty() || opt.inputs.size() != 1 ||
+			    !opt.timing.empty())){
+    std::cerr << "ERROR: --state needs --output and one typescript file "
+	      << "and does not work with --timing\n";
+    return false;
+  }
+  if(opt.follow && (opt.inputs.size() != 1 || !opt.output_dir.empty() ||
+		    !opt.timing.empty() || !opt.state.empty())){
+    std::cerr << "ERROR: --follow needs one typescript file and does not "
+	      << "work with --output-dir, --timing or --state\n";
+    return false;
+  }
+  if(opt.pipeline && (opt.threads > 1 || opt.follow || 
+		      !opt.timing.empty() || !opt.state.empty())){
+    std::cerr << "ERROR: --pipeline does not work with --threads, --follow, "
+	      << "--timing or --state\n";
+    return false;
+  }
+  if(opt.format != typescript2txt::TEXT && 
+     (!opt.timing.empty() || !opt.state.empty())){
+    std::cerr << "ERROR: --format does not work with --timing or --state\n";
+    return false;
+  }
+  if(!opt.index.empty() && opt.timing.empty()){
+    std::cerr << "ERROR: --index needs --timing\n";
+    return false;
+  }
+  if(!opt.timing.empty() && 
+     (opt.inputs.size() != 1 || !opt.output_dir.empty() || opt.stream)){
+    std::cerr << "ERROR: --timing needs one typescript file and does not "
+	      << "work with --output-dir or --stream\n";
+    return false;
+  }
+  return true;
+}
+
+/// \brief If \a format is HTML, write the start of the page that holds
+/// \brief the lines converted from \a name
+void begin_document(LineWriter& out, Format format, const std::string& name){
+  if(format != typescript2txt::HTML){
+    return;
+  }
+  std::ostringstream page;
+  std::string title;
+  append_html(name, title);
+  //A newline right after <pre> is not displayed, so the first line
+  //can follow on a line of its own
+  page << "<!DOCTYPE html>\n<html>\n<head><meta charset=\"utf-8\">"
+       << "<title>" << title << "</title></head>\n<body style=\"margin:0\">"
+       << "<pre style=\"margin:0;padding:1em;" << std::hex << std::setfill('0')
+       << "color:#" << std::setw(6) << StyleTable::html_fg 
+       << ";background:#" << std::setw(6) << StyleTable::html_bg << "\">";
+  std::string text = page.str();
+  out.write_line(text.data(), text.size());
+}
+
+/// Write the end of the page begun by begin_document
+void end_document(LineWriter& out, Format format){
+  if(format == typescript2txt::HTML){
+    static const char end[] = "</pre></body></html>";
+    out.write_line(end, sizeof(end) - 1);
+  }
+}
+
+/// \brief Convert the typescript read from \a in_fd to text written
+/// \brief to \a out_fd
+///
+/// \param in_fd the descriptor the typescript is read from
+///
+/// \param in_name the name of the input, used in messages
+///
+/// \param out_fd the descriptor the text is written to
+///
+/// \param opt the conversion settings
+///
+/// \param warnings where the warnings about the typescript are written
+///
+/// \return true on success, false if there was an error (which has
+///         already been reported on std::cerr)
+bool convert(int in_fd, const char* in_name, int out_fd, const Options& opt, 
+	     std::ostream& warnings){
+  struct stat st;
+  if(opt.threads > 1 && !opt.stream && opt.format == typescript2txt::TEXT &&
+     fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if(map != MAP_FAILED && 
+       compression_of(static_cast<const char*>(map), st.st_size) != 
+       UNCOMPRESSED){
+      //Compressed input is one stream, so it is read by one Reader below
+      munmap(map, st.st_size);
+      map = MAP_FAILED;
+    }
+    if(map != MAP_FAILED){
+      const char* begin = static_cast<const char*>(map);
+      std::size_t cols, rows;
+      script_header_size(begin, begin + st.st_size, cols, rows);
+      std::size_t width = opt.width ? opt.width : cols ? cols : 80;
+      std::size_t height = opt.height ? opt.height : rows ? rows : 24;
+      Diagnostics diag(warnings, opt.diagnostics);
+      LineWriter out(out_fd);
+      parse_parallel(begin, begin + st.st_size, opt.threads, width, height,
+		     opt.utf8, out, diag);
+      munmap(map, st.st_size);
+      diag.write_first_occurrences();
+      diag.summarize();
+      if(!out.flush()){
+	std::cerr << "ERROR: could not write output for " << in_name << ": " 
+		  << std::strerror(out.write_error()) << "\n";
+	return false;
       }
+      return true;
     }
   }
+  Reader r;
+  if(opt.width){ r.set_width(opt.width); }
+  if(opt.height){ r.set_height(opt.height); }
+  r.size_from_header(opt.width == 0, opt.height == 0);
+  r.set_utf8(opt.utf8);
+  r.set_format(opt.format);
+  r.diagnostics().set_output(warnings);
+  r.diagnostics().set_mode(opt.diagnostics);
+  std::unique_ptr<OutputThread> writer;
+  if(opt.pipeline){
+    writer.reset(new OutputThread(out_fd));
+  }
+  LineWriter out = writer ? LineWriter(writer->blocks()) : LineWriter(out_fd);
+  begin_document(out, opt.format, in_name);
+  if(opt.stream){
+    r.stream_to(out);
+  }
+  //After a read error, what was read before it is still written
+  bool ok = read_fd(r, in_fd, in_name, opt.throughput ? &std::cerr : NULL, 
+		    opt.pipeline);
+  r.write_to(out);
+  end_document(out, opt.format);
+  r.diagnostics().summarize();
+  out.flush();
+  int error = writer ? writer->finish() : out.write_error();
+  if(error != 0){
+    std::cerr << "ERROR: could not write output for " << in_name << ": " 
+	      << std::strerror(error) << "\n";
+    return false;
+  }
+  return ok;
+}
+
+/// One file to convert in batch mode
+struct BatchJob{
+  /// The typescript to read
+  std::string input;
+  /// Where the text is written
+  std::string output;
+  /// The size of the input in bytes
+  uint64_t size;
+  /// How long the conversion took
+  double seconds;
+  /// True if the conversion succeeded
+  bool ok;
+
+  /// Create the job converting \a input of \a size bytes to \a output
+  BatchJob(const std::string& input, const std::string& output, 
+	   uint64_t size)
+    :input(input),output(output),size(size),seconds(0),ok(false){}
+
+  /// Return true if a is larger than b (so is scheduled earlier)
+  static bool larger(const BatchJob& a, const BatchJob& b){
+    return a.size > b.size;
+  }
 };
 
-void Reader::read_from(std::istream& in){
-  while(in){
-    RState next_state = SAW_NOTHING;
-    int tmp_val;
-    char c = in.get();
-    if(in.eof()){ break; } //Don't process end of file
-    //Process control characters unless in an operating system command
-    //that terminates with a BEL character
-    if(state != SAW_OSC_EAT_2_BEL){ 
-      if(id_and_process_control_char(c)){
-	continue;
+/// \brief Add the batch jobs for \a path (a file, or a directory
+/// \brief whose files are all added) to \a jobs
+///
+/// \param extension ends the name of each output file
+///
+/// \return false if \a path could not be read (which has already been
+///         reported on std::cerr)
+bool add_batch_jobs(const std::string& path, const std::string& output_dir,
+		    const char* extension, std::vector<BatchJob>& jobs){
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0){
+    std::cerr << "ERROR: could not open " << path << ": " 
+	      << std::strerror(errno) << "\n";
+    return false;
+  }
+  if(S_ISDIR(st.st_mode)){
+    DIR* dir = opendir(path.c_str());
+    if(dir == NULL){
+      std::cerr << "ERROR: could not read directory " << path << ": " 
+		<< std::strerror(errno) << "\n";
+      return false;
+    }
+    std::vector<std::string> names;
+    while(struct dirent* entry = readdir(dir)){
+      if(entry->d_name[0] != '.'){
+	names.push_back(entry->d_name);
       }
     }
-    switch(state){
-    case SAW_NOTHING:
-      put_char(c);
-      break;
-    case SAW_ESC: ///ESC ( ^] ) was seen (but no trailing ] or [ )
-      next_state = SAW_NOTHING;
-      switch(c){
-      case 'c': break; //Terminal reset, do nothing
-      case 'D': line_feed(); break; //Line feed
-      case 'E': carriage_return(); line_feed(); break; //Newline
-      case 'H': set_htab_stop(); break; //Set tab stop
-      case 'M': reverse_line_feed(); break; //Reverse line feed
-      case 'Z': break; //Ignore dec identification code request
-      case '7': save_cursor_state(); break; //Save cursor state
-      case '8': restore_cursor_state(); break; //Restore cursor state
-      case '[': next_state = SAW_CSI; break; //Control sequence introducer
-      case '%': next_state = SAW_ESC_PCT; break; //ESC %
-      case '#': next_state = SAW_ESC_NUM; break; //ESC #
-      case '(': next_state = SAW_ESC_LPAREN; break; //ESC (
-      case ')': next_state = SAW_ESC_RPAREN; break; //ESC )
-      case '>': break; //Ignore numeric keypad mode
-      case '=': break; //Ignore application keypad mode
-      case ']': next_state = SAW_OSC; break; //Operating system command
-      default:
-	unknown_code("escape",c);
-      };
-      set_state(next_state);
-      break;
-    case SAW_CSI: ///Control sequence introducer - ESC [ or 0x9B
-      switch(c){
-      case '?':
-	if(params.size() != 0){
-	  std::cerr << "Warning: typescript contains badly formatted CSI code. "
-		    << "The ? character appears in the parameter list but is "
-		    << "not the first character.  Ignoring.";
-	};
-	break;
-      case '0': 
-      case '1': 
-      case '2': 
-      case '3': 
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9': 
-	if(params.size() == 0){
-	  params.push_back(0);
-	}
-	tmp_val = c-'0';
-	params.back() = (params.back()*10)+tmp_val;
-	break;
-      case ';':
-	if(params.size() == 0){
-	  params.push_back(0);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for(std::size_t i = 0; i < names.size(); ++i){
+      std::string file = path + "/" + names[i];
+      if(stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)){
+	jobs.push_back(BatchJob(file, output_dir + "/" + names[i] + extension,
+				st.st_size));
+      }
+    }
+    return true;
+  }
+  std::string::size_type slash = path.rfind('/');
+  std::string base = slash == std::string::npos ? path : path.substr(slash+1);
+  jobs.push_back(BatchJob(path, output_dir + "/" + base + extension, 
+			  S_ISREG(st.st_mode) ? st.st_size : 0));
+  return true;
+}
+
+/// Runs the jobs of a batch on a fixed number of threads
+///
+/// Each worker has its own queue of jobs.  The jobs are dealt out
+/// largest first so that the long conversions start early instead of
+/// holding up the end of the batch.  A worker whose queue is empty
+/// steals the largest job left in another worker's queue.
+class BatchPool{
+  /// The jobs waiting for one worker
+  struct Queue{
+    /// Protects jobs
+    std::mutex lock;
+    /// Indices into BatchPool::jobs, largest job first
+    std::deque<std::size_t> jobs;
+  };
+
+  /// The jobs to run
+  std::vector<BatchJob>& jobs;
+
+  /// The settings for each conversion
+  const Options& opt;
+
+  /// One queue per worker
+  std::vector<Queue> queues;
+
+  /// Protects std::cout and std::cerr, which all workers write to
+  std::mutex report_lock;
+
+  /// \brief Take the next job for worker \a w from its own queue or
+  /// \brief some other worker's.  Return false if there are none left.
+  bool next_job(std::size_t w, std::size_t& job){
+    for(std::size_t i = 0; i < queues.size(); ++i){
+      Queue& q = queues[(w + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(q.lock);
+      if(!q.jobs.empty()){
+	job = q.jobs.front();
+	q.jobs.pop_front();
+	return true;
+      }
+    }
+    return false;
+  }
+
+  /// Convert the file of \a job and report how it went
+  void run(BatchJob& job){
+    std::chrono::steady_clock::time_point start = 
+      std::chrono::steady_clock::now();
+    std::ostringstream warnings;
+    int in_fd = open(job.input.c_str(), O_RDONLY);
+    int out_fd = -1;
+    if(in_fd < 0){
+      warnings << "ERROR: could not open " << job.input << ": " 
+	       << std::strerror(errno) << "\n";
+    }else{
+      out_fd = open(job.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if(out_fd < 0){
+	warnings << "ERROR: could not create " << job.output << ": " 
+		 << std::strerror(errno) << "\n";
+      }else{
+	job.ok = convert(in_fd, job.input.c_str(), out_fd, opt, warnings);
+	if(close(out_fd) != 0 && job.ok){
+	  warnings << "ERROR: could not write " << job.output << ": " 
+		   << std::strerror(errno) << "\n";
+	  job.ok = false;
 	}
-	params.push_back(0);
-	break;
-      case '@':	insert_blank(params); set_state(SAW_NOTHING); break;
-      case 'A': cursor_up(params); set_state(SAW_NOTHING); break;
-      case 'B': cursor_down(params); set_state(SAW_NOTHING); break;
-      case 'C': cursor_right(params); set_state(SAW_NOTHING); break;
-      case 'D': 
-	unimplemented_CSI(c, "Cursor left", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'E': 
-	unimplemented_CSI(c, "Cursor down and to column 1", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'F': 
-	unimplemented_CSI(c, "Cursor up and to column 1", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'G': 
-	unimplemented_CSI(c, "Cursor to column", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'H': 
-	unimplemented_CSI(c, "Cursor to row, column (origin is 1,1)", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'J': 
-	unimplemented_CSI(c, "Erase display", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'K': erase_line(params); set_state(SAW_NOTHING); break;
-      case 'L': 
-	unimplemented_CSI(c, "Insert lines", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'M': 
-	unimplemented_CSI(c, "Delete lines", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'P': delete_characters(params); set_state(SAW_NOTHING); break;
-      case 'X': 
-	unimplemented_CSI(c, "Erase chars", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'a': 
-	unimplemented_CSI(c, "Cursor right", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'c': ignore_CSI(); set_state(SAW_NOTHING); //Ignore VT102 id seq.
-	break;
-      case 'd': 
-	unimplemented_CSI(c, "Cursor to row", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'e': 
-	unimplemented_CSI(c, "Cursor down", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'f': 
-	unimplemented_CSI(c, "Cursor to row, column", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'g': 
-	unimplemented_CSI(c, "Clear tab stop", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'h': 
-	unimplemented_CSI(c, "Set mode", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'l': 
-	unimplemented_CSI(c, "Reset mode", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'm': ignore_CSI(); set_state(SAW_NOTHING); //Ignore char attributes
-	break;
-      case 'n': 
-	unimplemented_CSI(c, "Device status report", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'q': ignore_CSI(); set_state(SAW_NOTHING); //Ignore LED setting
-	break;
-      case 'r': 
-	unimplemented_CSI(c, "Set srolling region", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 's': 
-	unimplemented_CSI(c, "Save cursor location", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case 'u': 
-	unimplemented_CSI(c, "Restore cursor location", params); 
-	set_state(SAW_NOTHING); 
-	break;
-      case '`': 
-	unimplemented_CSI(c, "Cursor to column", params); 
-	set_state(SAW_NOTHING); 
-	break;
-	//The following parameters were only in references/ctlseqs.pdf
-      case 'T': ignore_CSI(); set_state(SAW_NOTHING); //Ignore mouse tracking
-	break;
-      case 'x': ignore_CSI(); set_state(SAW_NOTHING); //Ignore term params req.
-	break;
-      default:
-	unknown_code("conrol sequence (0x9B or ESC [)",c);
       }
-      break;
-    case SAW_ESC_PCT: ///   ESC %
-      switch(c){
-      case '@':	
-      case 'G': 
-      case '8': select_character_set(c); break;
-      default:
-	unknown_code("character set select command ESC %",c);
-      };
-      set_state(SAW_NOTHING);
-      break;
-    case SAW_ESC_NUM: ///   ESC #
-      switch(c){
-      case '8':
-	std::cerr << "Warning: typescript file contains DEC screen "
-		  << "alignment command which is ignored "
-		  << "by this translator.\n";
-      default:
-	unknown_code("DEC screen alignment command ESC #",c);
-      };
-      set_state(SAW_NOTHING);
-      break;
-    case SAW_ESC_LPAREN:/// ESC (
-      switch(c){
-      case 'B': 
-      case '0':
-      case 'U':
-      case 'K': define_g_character_set(0,c); break;
-      default:
-	unknown_code("define G0 character set command ESC (",c);
-      };
-      set_state(SAW_NOTHING);
-      break;
-    case SAW_ESC_RPAREN: /// ESC )
-      switch(c){
-      case 'B': 
-      case '0':
-      case 'U':
-      case 'K': define_g_character_set(1,c); break;
-      default:
-	unknown_code("define G1 character set command ESC )",c);
-      };
-      set_state(SAW_NOTHING);
-      break;
-    case SAW_OSC: ///Operating system command ESC ]
-      next_state = SAW_NOTHING;
-      switch(c){
-      case 'P': next_state = SAW_OSC_P; break;
-      case 'R': reset_palette(); break;
-      case '0': next_state = SAW_OSC_EAT_2_BEL; break;
-      case '1': next_state = SAW_OSC_EAT_2_BEL; break;
-      case '2': next_state = SAW_OSC_EAT_2_BEL; break;
-      case '4': next_state = SAW_OSC_4; break;
-      case '5': next_state = SAW_OSC_5; break;
-      default:
-	unknown_code("operating system command ESC ]",c);
+      close(in_fd);
+    }
+    job.seconds = std::chrono::duration<double>
+      (std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> guard(report_lock);
+    if(!warnings.str().empty()){
+      std::cerr << "==> " << job.input << " <==\n" << warnings.str();
+    }
+    std::cout << job.input << (job.ok ? "" : " FAILED") << ": " 
+	      << job.size << " bytes in " << job.seconds << " s ("
+	      << mb_per_second(job.size, job.seconds) << " MB/s)\n";
+  }
+
+  /// The body of worker \a w
+  void work(std::size_t w){
+    std::size_t job;
+    while(next_job(w, job)){
+      run(jobs[job]);
+    }
+  }
+public:
+  /// Return the throughput of \a bytes in \a seconds in MB/s
+  static double mb_per_second(uint64_t bytes, double seconds){
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+  }
+
+  /// \brief Create a pool that runs \a jobs on \a opt.jobs workers.
+  /// \brief \a jobs must already be sorted largest first.
+  BatchPool(std::vector<BatchJob>& jobs, const Options& opt)
+    :jobs(jobs),opt(opt),queues(std::min(opt.jobs, jobs.size())){
+    for(std::size_t i = 0; i < jobs.size(); ++i){
+      queues[i % queues.size()].jobs.push_back(i);
+    }
+  }
+
+  /// Run all the jobs, returning when they are done
+  void run_all(){
+    std::vector<std::thread> workers;
+    for(std::size_t w = 1; w < queues.size(); ++w){
+      workers.push_back(std::thread(&BatchPool::work, this, w));
+    }
+    work(0);
+    for(std::size_t w = 0; w < workers.size(); ++w){
+      workers[w].join();
+    }
+  }
+};
+
+/// \brief Convert every input in \a opt to a file in opt.output_dir,
+/// \brief printing the throughput of each and of the whole batch
+///
+/// \return the exit status: 0 if every file was converted, 1 otherwise
+int run_batch(const Options& opt){
+  std::vector<BatchJob> jobs;
+  bool ok = true;
+  const char* extension = opt.format == typescript2txt::HTML ? ".html":".txt";
+  for(std::size_t i = 0; i < opt.inputs.size(); ++i){
+    ok = add_batch_jobs(opt.inputs[i], opt.output_dir, extension, jobs) && ok;
+  }
+  std::vector<std::string> outputs;
+  for(std::size_t i = 0; i < jobs.size(); ++i){
+    outputs.push_back(jobs[i].output);
+  }
+  std::sort(outputs.begin(), outputs.end());
+  std::vector<std::string>::iterator dup = 
+    std::adjacent_find(outputs.begin(), outputs.end());
+  if(dup != outputs.end()){
+    std::cerr << "ERROR: two inputs would both be written to " << *dup 
+	      << "\n";
+    return 1;
+  }
+  if(jobs.empty()){
+    return ok ? 0 : 1;
+  }
+  std::stable_sort(jobs.begin(), jobs.end(), BatchJob::larger);
+
+  std::chrono::steady_clock::time_point start = 
+    std::chrono::steady_clock::now();
+  BatchPool(jobs, opt).run_all();
+  double seconds = std::chrono::duration<double>
+    (std::chrono::steady_clock::now() - start).count();
+
+  uint64_t bytes = 0;
+  std::size_t failed = 0;
+  for(std::size_t i = 0; i < jobs.size(); ++i){
+    bytes += jobs[i].size;
+    if(!jobs[i].ok){ ++failed; }
+  }
+  std::cout << "Total: " << jobs.size() << " files, " << bytes 
+	    << " bytes in " << seconds << " s (" 
+	    << BatchPool::mb_per_second(bytes, seconds) << " MB/s) using " 
+	    << std::min(opt.jobs, jobs.size()) << " threads";
+  if(failed > 0){
+    std::cout << ", " << failed << " failed";
+  }
+  std::cout << "\n";
+  return (ok && failed == 0) ? 0 : 1;
+}
+
+/// \brief A regular file mapped into memory for reading
+class MappedFile{
+  /// The contents, NULL if nothing is mapped
+  const char* mem;
+  /// The size of the file
+  std::size_t len;
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+public:
+  /// Create an object with no file mapped
+  MappedFile():mem(NULL),len(0){}
+
+  ~MappedFile(){
+    if(mem != NULL){
+      munmap(const_cast<char*>(mem), len);
+    }
+  }
+
+  /// \brief Map the regular file \a name
+  ///
+  /// \return false if it could not be mapped (which has already been
+  ///         reported on std::cerr)
+  bool open(const char* name){
+    int fd = ::open(name, O_RDONLY);
+    if(fd < 0){
+      std::cerr << "ERROR: could not open " << name << ": " 
+		<< std::strerror(errno) << "\n";
+      return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+      std::cerr << "ERROR: " << name << " is not a regular file\n";
+      close(fd);
+      return false;
+    }
+    if(st.st_size > 0){
+      void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map == MAP_FAILED){
+	std::cerr << "ERROR: could not map " << name << ": " 
+		  << std::strerror(errno) << "\n";
+	close(fd);
+	return false;
       }
-      set_state(next_state);
+      mem = static_cast<const char*>(map);
+      len = st.st_size;
+    }
+    close(fd);
+    return true;
+  }
+
+  /// Return the first byte of the file
+  const char* begin() const{ return mem; }
+
+  /// Return one past the last byte of the file
+  const char* end() const{ return mem + len; }
+
+  /// Return the size of the file
+  std::size_t size() const{ return len; }
+};
+
+/// \brief Make \a data the contents of the file \a name
+///
+/// The data is written to a temporary file that then replaces \a
+/// name, so readers never see half of it.
+///
+/// \return false if it could not be written (which has already been
+///         reported on std::cerr)
+bool replace_file(const std::string& name, const std::string& data){
+  const std::string tmp = name + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    std::cerr << "ERROR: could not create " << tmp << ": " 
+	      << std::strerror(errno) << "\n";
+    return false;
+  }
+  const char* p = data.data();
+  const char* end = p + data.size();
+  while(p != end){
+    ssize_t written = write(fd, p, end - p);
+    if(written < 0 && errno != EINTR){
       break;
-    case SAW_OSC_EAT_2_BEL:
-      if(c=='\x07'){ //^G seen, go back to normal mode
-	set_state(SAW_NOTHING);
+    }
+    p += std::max<ssize_t>(written, 0);
+  }
+  if(close(fd) != 0 || p != end || rename(tmp.c_str(), name.c_str()) != 0){
+    std::cerr << "ERROR: could not write " << name << ": " 
+	      << std::strerror(errno) << "\n";
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/// \brief Reads the timing file that script -t (or --log-timing)
+/// \brief writes next to a typescript
+///
+/// Each line of the classic format is "delay bytes": \a bytes more
+/// bytes of the typescript were written \a delay seconds after those
+/// of the line before.  In the advanced format (script
+/// --logging-format=advanced) each line starts with a type letter:
+/// O lines are output as above, I lines are input (kept in another
+/// file) and H and S lines are header information and signals.  Only
+/// output moves through the typescript, but the delays of all lines
+/// count.
+class TimingFile{
+  /// The first byte of the file
+  const char* begin;
+  /// The next line to read
+  const char* p;
+  /// One past the last byte of the file
+  const char* end;
+  /// True if a line could not be read
+  bool bad;
+public:
+  /// Read the timing file in [\a begin, \a end) from \a start
+  TimingFile(const char* begin, const char* start, const char* end)
+    :begin(begin),p(start),end(end),bad(false){}
+
+  /// \brief Read the next line, setting \a delay to its delay and \a
+  /// \brief bytes to the number of typescript bytes it covers (0 if it
+  /// \brief is not output)
+  ///
+  /// \return false at the end of the file or at a line that cannot be
+  ///         read (see failed)
+  bool next(double& delay, uint64_t& bytes){
+    if(p == end || bad){
+      return false;
+    }
+    const void* nl = std::memchr(p, '\n', end - p);
+    const char* line_end = nl ? static_cast<const char*>(nl) : end;
+    const std::string line(p, line_end);
+    const char* s = line.c_str();
+    char type = 'O';
+    if(isalpha((unsigned char)s[0]) && s[1] == ' '){
+      type = s[0];
+      s += 2;
+    }
+    char* after;
+    delay = std::strtod(s, &after);
+    bytes = 0;
+    if(after == s || !(delay >= 0 && delay < 1e9)){
+      bad = true;
+      return false;
+    }
+    if(type == 'O' || type == 'I'){
+      s = after;
+      unsigned long long n = std::strtoull(s, &after, 10);
+      if(after == s || (*after != '\0' && !isspace((unsigned char)*after))){
+	bad = true;
+	return false;
       }
-      break;
-    case SAW_OSC_4:
-      if(c!='6'){
-	unknown_code("operating system command number 4 (ESC ] 4)",c);
+      if(type == 'O'){
+	bytes = n;
       }
-      set_state(SAW_OSC_EAT_2_BEL);
-      break;
-    case SAW_OSC_5:
-      if(c!='0'){
-	unknown_code("operating system command number 5 (ESC ] 5)",c);
+    }else if(type != 'H' && type != 'S'){
+      bad = true;
+      return false;
+    }
+    p = nl ? line_end + 1 : end;
+    return true;
+  }
+
+  /// Return true if a line could not be read
+  bool failed() const{ return bad; }
+
+  /// Return the offset in the file of the next line to read
+  uint64_t offset() const{ return p - begin; }
+};
+
+/// The state of a replay at one point of the recording
+struct Checkpoint{
+  /// The time into the recording, in seconds
+  double time;
+  /// The number of bytes of the typescript read
+  uint64_t offset;
+  /// The offset in the timing file of the next line to read
+  uint64_t timing_offset;
+  /// The state of the Reader (see Reader::save)
+  std::string state;
+};
+
+/// \brief The checkpoints of the replay of one typescript, kept in a
+/// \brief file of their own so later seeks can start from them
+struct ReplayIndex{
+  /// The settings and input sizes the checkpoints were made with.  An
+  /// index whose key differs from the current one is out of date.
+  std::string key;
+  /// The checkpoints in the order of the recording
+  std::vector<Checkpoint> checkpoints;
+
+  /// \brief Make the key for replaying a typescript of \a size bytes
+  /// \brief with a timing file of \a timing_size bytes using \a opt
+  static std::string make_key(uint64_t size, uint64_t timing_size,
+			      const Options& opt){
+    std::string key = "typescript2txt replay index\n";
+    put_number(key, reader_state_version);
+    put_number(key, size);
+    put_number(key, timing_size);
+    put_number(key, opt.width);
+    put_number(key, opt.height);
+    put_number(key, opt.utf8);
+    put_number(key, opt.checkpoint_mb);
+    return key;
+  }
+
+  /// \brief Read the index in the file \a name, which must have the
+  /// \brief key \a expected_key
+  ///
+  /// \return false if the file is missing, unreadable or out of date
+  bool load(const std::string& name, const std::string& expected_key){
+    MappedFile file;
+    if(access(name.c_str(), F_OK) != 0 || !file.open(name.c_str())){
+      return false;
+    }
+    const char* p = file.begin();
+    const char* end = file.end();
+    if(file.size() < expected_key.size() ||
+       std::memcmp(p, expected_key.data(), expected_key.size()) != 0){
+      return false;
+    }
+    p += expected_key.size();
+    uint64_t count;
+    if(!get_number(p, end, count)){
+      return false;
+    }
+    key = expected_key;
+    checkpoints.clear();
+    for(uint64_t i = 0; i < count; ++i){
+      Checkpoint c;
+      uint64_t time_bits, state_size;
+      if(!get_number(p, end, time_bits) || !get_number(p, end, c.offset) ||
+	 !get_number(p, end, c.timing_offset) || 
+	 !get_number(p, end, state_size) || 
+	 (uint64_t)(end - p) < state_size){
+	return false;
       }
-      set_state(SAW_OSC_EAT_2_BEL);
-      break;
-    case SAW_OSC_P: ///ESC ] P (will read 7 hex digits)
-      //params[0] holds the number of hex digits read
-      //params[1] holds the index to set
-      //params[2] holds the color to set it to (24 bit integer)
-      if(params.size() != 3 && params.size() != 0){
-	std::cerr << "SERIOUS WARNING: incorrect number of parameters "
-		  << "in OSC palette setting command SAW_OSC_P\n"
-		  << "Ignoring\n"
-		  << issue_report_boilerplate();
-	params.clear();
-      }
-      if(params.size() == 0){
-	params.push_back(0); params.push_back(0); params.push_back(0);
-      }
-      tmp_val = -1;
-      switch(c){
-      case '0': tmp_val = 0; break;
-      case '1': tmp_val = 1; break;
-      case '2': tmp_val = 2; break;
-      case '3': tmp_val = 3; break;
-      case '4': tmp_val = 4; break;
-      case '5': tmp_val = 5; break;
-      case '6': tmp_val = 6; break;
-      case '7': tmp_val = 7; break;
-      case '8': tmp_val = 8; break;
-      case '9': tmp_val = 9; break;
-      case 'A': tmp_val = 10; break;
-      case 'B': tmp_val = 11; break;
-      case 'C': tmp_val = 12; break;
-      case 'D': tmp_val = 13; break;
-      case 'E': tmp_val = 14; break;
-      case 'F': tmp_val = 15; break;
-      default:
-	unknown_code("palette set command ESC ] P",c);
-      }
-      if(tmp_val != -1){
-	++params.at(0);
-	if(params.at(0) == 1){
-	  params.at(1) = tmp_val;
-	}else if(params.at(0) > 1 && params.at(0) <= 7){
-	  params.at(2) = (params.at(2) << 4) + tmp_val;
-	  if(params.at(0) == 7){
-	    set_palette(params.at(1), params.at(2));
-	  }
-	}else{
-	  std::cerr << "SERIOUS WARNING: incorrect number of digits read "
-		    << '(' << params.at(0) << ')'
-		    << "in OSC palette setting command SAW_OSC_P\n"
-		    << "Ignoring\n"
-		    << issue_report_boilerplate();
-	}
+      std::memcpy(&c.time, &time_bits, sizeof(c.time));
+      c.state.assign(p, state_size);
+      p += state_size;
+      checkpoints.push_back(c);
+    }
+    return p == end;
+  }
+
+  /// \brief Write the index to the file \a name (see replace_file)
+  ///
+  /// \return false if it could not be written (which has already been
+  ///         reported on std::cerr)
+  bool save(const std::string& name) const{
+    std::string data = key;
+    put_number(data, checkpoints.size());
+    for(std::size_t i = 0; i < checkpoints.size(); ++i){
+      const Checkpoint& c = checkpoints[i];
+      uint64_t time_bits;
+      std::memcpy(&time_bits, &c.time, sizeof(time_bits));
+      put_number(data, time_bits);
+      put_number(data, c.offset);
+      put_number(data, c.timing_offset);
+      put_number(data, c.state.size());
+      data += c.state;
+    }
+    return replace_file(name, data);
+  }
+};
+
+/// \brief Set up \a r to replay a typescript using the settings in
+/// \brief \a opt, throwing away the lines that leave the screen
+///
+/// Replays run in streaming mode so that their state (and so each
+/// checkpoint) holds only the lines near the screen.
+void start_replay(Reader& r, const Options& opt, LineWriter& discard){
+  if(opt.width){ r.set_width(opt.width); }
+  if(opt.height){ r.set_height(opt.height); }
+  r.size_from_header(opt.width == 0, opt.height == 0);
+  r.set_utf8(opt.utf8);
+  r.diagnostics().set_mode(Diagnostics::NONE);
+  r.stream_to(discard);
+}
+
+/// \brief Return the offset in the typescript \a ts where the bytes
+/// \brief counted by its timing file start
+///
+/// That is after the header line, which script writes without timing.
+uint64_t timed_start(const MappedFile& ts){
+  std::size_t cols, rows;
+  const char* header_end = script_header_size(ts.begin(), ts.end(), 
+					      cols, rows);
+  return header_end == NULL ? 0 : header_end + 1 - ts.begin();
+}
+
+/// \brief Replay the whole typescript \a ts with its timing file \a
+/// \brief timing, saving a checkpoint in \a index after every
+/// \brief opt.checkpoint_mb megabytes
+///
+/// \return false if the timing file could not be read (which has
+///         already been reported on std::cerr)
+bool build_replay_index(const MappedFile& ts, const MappedFile& timing,
+			const Options& opt, ReplayIndex& index){
+  Reader r;
+  LineWriter discard(-1);
+  start_replay(r, opt, discard);
+  const uint64_t spacing = (uint64_t)opt.checkpoint_mb * 1000000;
+  TimingFile steps(timing.begin(), timing.begin(), timing.end());
+  uint64_t offset = timed_start(ts);
+  uint64_t read_to = 0;
+  uint64_t next_checkpoint = spacing;
+  double time = 0, delay;
+  uint64_t bytes;
+  index.checkpoints.clear();
+  while(steps.next(delay, bytes)){
+    time += delay;
+    offset = std::min<uint64_t>(offset + bytes, ts.size());
+    if(offset >= next_checkpoint){
+      r.read_from(ts.begin() + read_to, ts.begin() + offset);
+      read_to = offset;
+      Checkpoint c;
+      c.time = time;
+      c.offset = offset;
+      c.timing_offset = steps.offset();
+      r.save(c.state);
+      index.checkpoints.push_back(c);
+      next_checkpoint = offset + spacing;
+    }
+  }
+  if(steps.failed()){
+    std::cerr << "ERROR: could not read the line at byte " 
+	      << steps.offset() << " of " << opt.timing << "\n";
+    return false;
+  }
+  return true;
+}
+
+/// \brief Write the screen as it was opt.at seconds into the recording
+/// \brief of opt.inputs[0], whose timing file is opt.timing
+///
+/// With opt.index, the replay starts from the last checkpoint before
+/// that time.  The index is made first if it is missing or was made
+/// for other inputs or settings.
+///
+/// \return the exit status: 0 on success, 1 on an error (which has
+///         already been reported on std::cerr)
+int run_replay(const Options& opt){
+  MappedFile ts, timing;
+  if(!ts.open(opt.inputs[0].c_str()) || !timing.open(opt.timing.c_str())){
+    return 1;
+  }
+  if(refuse_compressed(ts.begin(), ts.size(), opt.inputs[0].c_str(), 
+		       "--timing")){
+    return 1;
+  }
+  ReplayIndex index;
+  if(!opt.index.empty()){
+    const std::string key = 
+      ReplayIndex::make_key(ts.size(), timing.size(), opt);
+    if(!index.load(opt.index, key)){
+      index.key = key;
+      if(!build_replay_index(ts, timing, opt, index) || 
+	 !index.save(opt.index)){
+	return 1;
       }
+    }
+  }
+
+  Reader r;
+  LineWriter discard(-1);
+  start_replay(r, opt, discard);
+  uint64_t offset = timed_start(ts);
+  uint64_t read_to = 0;
+  uint64_t timing_offset = 0;
+  double time = 0;
+  std::size_t k = index.checkpoints.size();
+  while(k > 0 && index.checkpoints[k-1].time > opt.at){
+    --k;
+  }
+  if(k > 0){
+    const Checkpoint& c = index.checkpoints[k-1];
+    const char* p = c.state.data();
+    if(!r.restore(p, p + c.state.size()) || c.offset > ts.size() ||
+       c.timing_offset > timing.size()){
+      std::cerr << "ERROR: " << opt.index << " is damaged.  Delete it to "
+		<< "have it made again.\n";
+      return 1;
+    }
+    time = c.time;
+    offset = read_to = c.offset;
+    timing_offset = c.timing_offset;
+  }
+  TimingFile steps(timing.begin(), timing.begin() + timing_offset, 
+		   timing.end());
+  double delay;
+  uint64_t bytes;
+  while(steps.next(delay, bytes) && time + delay <= opt.at){
+    time += delay;
+    offset = std::min<uint64_t>(offset + bytes, ts.size());
+  }
+  if(steps.failed()){
+    std::cerr << "ERROR: could not read the line at byte " 
+	      << steps.offset() << " of " << opt.timing << "\n";
+    return 1;
+  }
+  r.read_from(ts.begin() + read_to, ts.begin() + offset);
+  LineWriter out(1);
+  r.write_screen(out);
+  if(!out.flush()){
+    std::cerr << "ERROR: could not write output: " 
+	      << std::strerror(out.write_error()) << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+/// \brief Return a hash of the (up to) 4096 bytes of \a in before
+/// \brief \a offset, to tell whether a file still starts the way it did
+uint64_t tail_check(const MappedFile& in, uint64_t offset){
+  uint64_t hash = 14695981039346656037ull; //FNV-1a
+  for(uint64_t i = offset - std::min<uint64_t>(offset, 4096); i < offset; ++i){
+    hash = (hash ^ (unsigned char)in.begin()[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/// \brief Convert opt.inputs[0] to opt.output, continuing from the
+/// \brief state that the last run saved in opt.state
+///
+/// For logs that are still growing: each run reads only the bytes
+/// added since the last one.  The run before left its committed text
+/// (the lines that scrolled off the screen) at the start of the
+/// output, followed by the lines still on the screen.  This run cuts
+/// the output back to the committed text, restores the Reader, reads
+/// the new bytes, saves its own state and writes the lines now on the
+/// screen.  So after every run the output is exactly what one --stream
+/// run over the whole input would write.
+///
+/// The input starts again from the beginning if there is no saved
+/// state, if the state was saved with other settings, or if the input
+/// no longer has the bytes the state was saved after.
+///
+/// \return the exit status: 0 on success, 1 on an error (which has
+///         already been reported on std::cerr)
+int run_incremental(const Options& opt){
+  const char* name = opt.inputs[0].c_str();
+  MappedFile in;
+  if(!in.open(name)){
+    return 1;
+  }
+  if(refuse_compressed(in.begin(), in.size(), name, "--state")){
+    return 1;
+  }
+  int out_fd = ::open(opt.output.c_str(), O_WRONLY | O_CREAT, 0644);
+  struct stat out_st;
+  if(out_fd < 0 || fstat(out_fd, &out_st) != 0){
+    std::cerr << "ERROR: could not open " << opt.output << ": " 
+	      << std::strerror(errno) << "\n";
+    return 1;
+  }
+
+  std::string key = "typescript2txt state\n";
+  put_number(key, reader_state_version);
+  put_number(key, opt.width);
+  put_number(key, opt.height);
+  put_number(key, opt.utf8);
+
+  std::unique_ptr<Reader> r;
+  uint64_t offset = 0, committed = 0;
+  MappedFile saved;
+  if(access(opt.state.c_str(), F_OK) == 0 && saved.open(opt.state.c_str())
+     && saved.size() >= key.size() && 
+     std::memcmp(saved.begin(), key.data(), key.size()) == 0){
+    const char* p = saved.begin() + key.size();
+    uint64_t check;
+    r.reset(new Reader);
+    if(!get_number(p, saved.end(), offset) || 
+       !get_number(p, saved.end(), check) ||
+       !get_number(p, saved.end(), committed) ||
+       offset > in.size() || tail_check(in, offset) != check || 
+       committed > (uint64_t)out_st.st_size ||
+       !r->restore(p, saved.end()) || p != saved.end()){
+      r.reset();
+    }
+  }
+  if(!r){
+    r.reset(new Reader);
+    offset = committed = 0;
+    if(opt.width){ r->set_width(opt.width); }
+    if(opt.height){ r->set_height(opt.height); }
+    r->size_from_header(opt.width == 0, opt.height == 0);
+    r->set_utf8(opt.utf8);
+  }
+  r->diagnostics().set_mode(opt.diagnostics);
+  if(ftruncate(out_fd, committed) != 0 || 
+     lseek(out_fd, committed, SEEK_SET) < 0){
+    std::cerr << "ERROR: could not truncate " << opt.output << ": " 
+	      << std::strerror(errno) << "\n";
+    close(out_fd);
+    return 1;
+  }
+
+  bool ok;
+  {
+    LineWriter out(out_fd);
+    r->stream_to(out);
+    r->read_from(in.begin() + offset, in.end());
+    ok = out.flush();
+    off_t now_committed = lseek(out_fd, 0, SEEK_CUR);
+    if(ok && now_committed >= 0){
+      std::string state = key;
+      put_number(state, in.size());
+      put_number(state, tail_check(in, in.size()));
+      put_number(state, now_committed);
+      r->save(state);
+      if(!replace_file(opt.state, state)){
+	close(out_fd);
+	return 1;
+      }
+    }
+    r->write_to(out);
+    ok = out.flush() && ok;
+    if(!ok){
+      std::cerr << "ERROR: could not write " << opt.output << ": " 
+		<< std::strerror(out.write_error()) << "\n";
+    }
+  }
+  r->diagnostics().summarize();
+  if(close(out_fd) != 0 && ok){
+    std::cerr << "ERROR: could not write " << opt.output << ": " 
+	      << std::strerror(errno) << "\n";
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
+
+/// Set when SIGINT or SIGTERM asks run_follow to stop
+static volatile sig_atomic_t stop_following = 0;
+
+/// The handler for the signals that stop run_follow
+static void request_stop(int){
+  stop_following = 1;
+}
+
+/// \brief Return a new Reader set up as \a opt asks, streaming the
+/// \brief lines it commits to \a out
+std::unique_ptr<Reader> follow_reader(const Options& opt, LineWriter& out){
+  std::unique_ptr<Reader> r(new Reader);
+  if(opt.width){ r->set_width(opt.width); }
+  if(opt.height){ r->set_height(opt.height); }
+  r->size_from_header(opt.width == 0, opt.height == 0);
+  r->set_utf8(opt.utf8);
+  r->set_format(opt.format);
+  r->diagnostics().set_mode(opt.diagnostics);
+  r->stream_to(out);
+  return r;
+}
+
+/// \brief Convert opt.inputs[0] while it is being written, like tail
+/// \brief -f, writing each line to \a out_fd as soon as it is committed
+///
+/// Runs in streaming mode: a line is written once it scrolls off the
+/// screen, so it can no longer change.  Whatever has been written to
+/// the file is read and converted and the output flushed; then the
+/// reader sleeps until the file changes (waiting on inotify, or
+/// checking every 100 ms where inotify is not available), so it uses
+/// no CPU while the session is idle.  SIGINT or SIGTERM stops it,
+/// writing the lines still on the screen, so the output is then the
+/// same as that of --stream.
+///
+/// If the file is truncated, the lines on the screen are written and
+/// the file is converted again from its start by a new reader, as if
+/// it were a new typescript appended to the output.
+///
+/// Unless warnings are turned off, the time from waking up to having
+/// written everything that was new is reported at the end.
+///
+/// \return the exit status: 0 on success, 1 on an error (which has
+///         already been reported on std::cerr)
+int run_follow(const Options& opt, int out_fd){
+  const char* name = opt.inputs[0].c_str();
+  int fd = ::open(name, O_RDONLY);
+  if(fd < 0){
+    std::cerr << "ERROR: could not open " << name << ": " 
+	      << std::strerror(errno) << "\n";
+    return 1;
+  }
+  LineWriter out(out_fd);
+  begin_document(out, opt.format, opt.inputs[0]);
+  std::unique_ptr<Reader> r = follow_reader(opt, out);
+  std::unique_ptr<HeaderFeed> feed(new HeaderFeed(*r));
+
+  //The stop signals are blocked except while waiting, so one that
+  //arrives just before the wait still ends it
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigset_t stop_signals, wait_mask;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stop_signals, &wait_mask);
+  sigdelset(&wait_mask, SIGINT);
+  sigdelset(&wait_mask, SIGTERM);
+
+  int watch = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if(watch >= 0 && 
+     inotify_add_watch(watch, name, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+		       IN_MOVE_SELF | IN_DELETE_SELF) < 0){
+    close(watch);
+    watch = -1;
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point woke = Clock::now();
+  bool fresh = false; //True if new bytes were read since waking
+  uint64_t updates = 0;
+  double total_latency = 0, max_latency = 0;
+  off_t position = 0;
+  bool ok = true;
+  std::vector<char> block(1024*1024);
+  while(!stop_following){
+    ssize_t got = read(fd, &block.front(), block.size());
+    if(got > 0){
+      const char* begin = &block.front();
+      if(position == 0 && refuse_compressed(begin, got, name, "--follow")){
+	ok = false;
+	break;
+      }
+      feed->feed(begin, begin + got);
+      position += got;
+      fresh = true;
+      //Flush every block so a burst of output cannot delay the lines
+      //at its start
+      if(!out.flush()){ break; }
+      continue;
+    }
+    if(got < 0){
+      if(errno == EINTR){ continue; }
+      std::cerr << "ERROR: could not read " << name << ": " 
+		<< std::strerror(errno) << "\n";
+      ok = false;
       break;
-    case SAW_CSI_LBRACKET: /// ESC [ [ or CSI [ (just eats next char)
-      set_state(SAW_NOTHING);
-      break;
-    default:
-      std::cerr << "ERROR: Unknown reader state (" << ((unsigned)state)
-		<< ") encountered in read_from\n";
-      exit(-2);
     }
+    if(fresh){
+      double latency = std::chrono::duration<double>(Clock::now() - woke)
+	.count();
+      ++updates;
+      total_latency += latency;
+      max_latency = std::max(max_latency, latency);
+      fresh = false;
+    }
+    if(watch >= 0){
+      struct pollfd p;
+      p.fd = watch;
+      p.events = POLLIN;
+      ppoll(&p, 1, NULL, &wait_mask);
+      char events[4096];
+      while(read(watch, events, sizeof(events)) > 0){}
+    }else{
+      struct timespec interval = {0, 100*1000*1000};
+      ppoll(NULL, 0, &interval, &wait_mask);
+    }
+    woke = Clock::now();
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size < position){
+      if(opt.diagnostics != Diagnostics::NONE){
+	std::cerr << "WARNING: " << name << " was truncated.  Reading it "
+		  << "again from the start.\n";
+      }
+      feed->finish();
+      r->write_to(out);
+      r->diagnostics().summarize();
+      feed.reset();
+      r = follow_reader(opt, out);
+      feed.reset(new HeaderFeed(*r));
+      lseek(fd, 0, SEEK_SET);
+      position = 0;
+      if(!out.flush()){ break; }
+    }
+  }
+  if(watch >= 0){
+    close(watch);
+  }
+  close(fd);
+  feed->finish();
+  r->write_to(out);
+  end_document(out, opt.format);
+  if(!out.flush()){
+    std::cerr << "ERROR: could not write output: " 
+	      << std::strerror(out.write_error()) << "\n";
+    ok = false;
+  }
+  r->diagnostics().summarize();
+  if(opt.diagnostics != Diagnostics::NONE && updates > 0){
+    std::cerr << "Followed " << updates << " updates: from waking up to "
+	      << "writing the new lines took " << std::fixed 
+	      << std::setprecision(3) << total_latency / updates * 1000 
+	      << " ms on average and " << max_latency * 1000 
+	      << " ms at most\n";
   }
+  return ok ? 0 : 1;
 }
 
-int main(){
-  Reader r;
-  r.read_from(std::cin);
-  r.write_to(std::cout);
+} // namespace
+
+int main(int argc, char** argv){
+  Options opt;
+  if(!parse_options(argc, argv, opt)){
+    return 1;
+  }
+  if(!opt.output_dir.empty()){
+    return run_batch(opt);
+  }
+  if(!opt.timing.empty()){
+    return run_replay(opt);
+  }
+  if(!opt.state.empty()){
+    return run_incremental(opt);
+  }
+  int out_fd = 1;
+  if(!opt.output.empty()){
+    out_fd = open(opt.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0){
+      std::cerr << "ERROR: could not create " << opt.output << ": " 
+		<< std::strerror(errno) << "\n";
+      return 1;
+    }
+  }
+  bool ok;
+  if(opt.follow){
+    ok = run_follow(opt, out_fd) == 0;
+  }else if(!opt.inputs.empty()){
+    const char* name = opt.inputs[0].c_str();
+    int fd = open(name, O_RDONLY);
+    if(fd < 0){
+      std::cerr << "ERROR: could not open " << name << ": " 
+		<< std::strerror(errno) << "\n";
+      return 1;
+    }
+    ok = convert(fd, name, out_fd, opt, std::cerr);
+    close(fd);
+  }else{
+    ok = convert(0, "standard input", out_fd, opt, std::cerr);
+  }
+  if(out_fd != 1 && close(out_fd) != 0){
+    std::cerr << "ERROR: could not write " << opt.output << ": " 
+	      << std::strerror(errno) << "\n";
+    ok = false;
+  }
+  return ok ? 0 : 1;
 }
+
+#endif
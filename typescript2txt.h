@@ -0,0 +1,125 @@
+/********************************************************************
+ * typescript2txt.h - convert script output to text from inside
+ * another program
+ *
+ * The typescript is pushed into a Converter in pieces of any size as
+ * it arrives (from a socket, a pty, a decompressor ...) and the text
+ * comes out of the other end one line at a time, as soon as each line
+ * has scrolled off the terminal screen and can no longer change.  The
+ * lines are exactly those "typescript2txt --stream" would write.
+ *
+ *     struct Print: typescript2txt::LineSink{
+ *       void line(std::string_view text){
+ *         std::cout << text << '\n';
+ *       }
+ *     };
+ *
+ *     Print print;
+ *     typescript2txt::Converter conv(print);
+ *     while((got = read(fd, buf, sizeof(buf))) > 0){
+ *       conv.feed(buf, got);
+ *     }
+ *     conv.finish();
+ *
+ * Link with libtypescript2txt.a (built by "make lib").
+ *
+ * Permission is granted to distribute this software under any version
+ * of the BSD and GPL licenses.
+ *******************************************************************/
+
+#ifndef TYPESCRIPT2TXT_H
+#define TYPESCRIPT2TXT_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string_view>
+
+namespace typescript2txt{
+
+/// Receives the lines of text produced from a typescript
+class LineSink{
+public:
+  virtual ~LineSink(){}
+
+  /// \brief Take the next line of the text
+  ///
+  /// \param text the characters of the line, without a newline.  They
+  ///        are not copied: they belong to the converter and are only
+  ///        valid until this call returns.
+  virtual void line(std::string_view text) = 0;
+};
+
+/// How the lines of text are written
+enum Format{
+  /// Plain text: the characters only
+  TEXT,
+  /// HTML text, with each run of characters in a colour or other
+  /// attribute (set by SGR, CSI ... m) in a span element with inline
+  /// CSS.  Every line stands alone; put them in a pre element.
+  HTML,
+  /// Text with the fewest SGR escape sequences that reproduce the
+  /// attributes, each line starting and ending in the default style
+  ANSI
+};
+
+/// How a Converter interprets its typescript
+struct Settings{
+  /// The number of columns of the terminal, or 0 to take it from the
+  /// script header (80 if there is none)
+  std::size_t width = 0;
+
+  /// The number of lines of the terminal, or 0 to take it from the
+  /// script header (24 if there is none)
+  std::size_t height = 0;
+
+  /// If true, decode UTF-8 instead of treating each byte as a character
+  bool utf8 = false;
+
+  /// How the lines are written
+  Format format = TEXT;
+
+  /// Where to write the warnings about the typescript, or NULL to
+  /// leave them out
+  std::ostream* warnings = nullptr;
+};
+
+/// \brief Turns typescript bytes pushed into it into lines of text
+///
+/// At most one screen of lines is held at any time, so any length of
+/// typescript can be converted in constant memory.  The output does
+/// not depend on how the input is split between calls to feed.
+class Converter{
+  /// The reader and everything else hidden from users of the library
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+public:
+  /// \brief Create a converter that passes its lines to \a sink
+  ///
+  /// \param sink receives the lines.  It must outlive the converter.
+  ///
+  /// \param settings the size of the terminal and the like
+  explicit Converter(LineSink& sink, const Settings& settings = Settings());
+
+  ~Converter();
+
+  Converter(const Converter&) = delete;
+  Converter& operator=(const Converter&) = delete;
+
+  /// \brief Process the next \a len bytes of the typescript
+  ///
+  /// Any lines that scroll off the screen are passed to the sink
+  /// before this returns.  \a data may end in the middle of an escape
+  /// sequence or of a UTF-8 character.
+  void feed(const char* data, std::size_t len);
+
+  /// \brief Pass the lines still on the screen to the sink and write
+  /// \brief the summary of the warnings
+  ///
+  /// Call once, after the last feed.  Nothing may be fed afterwards.
+  void finish();
+};
+
+} // namespace typescript2txt
+
+#endif